@@ -24,13 +24,18 @@
 #endif
 
 #include "gstpixelflutsink.h"
+#include "gstpixelflutreplaysrc.h"
 
 GST_DEBUG_CATEGORY (pixelflut_debug);
 
 static gboolean
 plugin_init (GstPlugin * plugin)
 {
-  return gst_element_register (plugin, "pixelflutsink", GST_RANK_NONE, GST_TYPE_PIXELFLUTSINK);
+  if (!gst_element_register (plugin, "pixelflutsink", GST_RANK_NONE, GST_TYPE_PIXELFLUTSINK))
+    return FALSE;
+
+  return gst_element_register (plugin, "pixelflutreplaysrc", GST_RANK_NONE,
+      GST_TYPE_PIXELFLUTREPLAYSRC);
 }
 
 GST_PLUGIN_DEFINE (GST_VERSION_MAJOR,
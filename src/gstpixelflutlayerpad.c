@@ -0,0 +1,358 @@
+/*
+ * GStreamer Pixelflut
+ * Copyright 2018 Andreas Frisch <fraxinas@schaffenburg.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "gstpixelflutlayerpad.h"
+
+GST_DEBUG_CATEGORY_STATIC (pixelflutlayerpad_debug);
+#define GST_CAT_DEFAULT pixelflutlayerpad_debug
+
+G_DEFINE_TYPE (GstPixelflutLayerPad, gst_pixelflut_layer_pad, GST_TYPE_PAD);
+
+enum
+{
+  PROP_0,
+  PROP_XPOS,
+  PROP_YPOS,
+  PROP_ZORDER,
+};
+
+#define DEFAULT_XPOS 0
+#define DEFAULT_YPOS 0
+#define DEFAULT_ZORDER 1
+/* frames queued ahead of the sink before upstream is blocked */
+#define LAYER_QUEUE_MAX 2
+
+static void gst_pixelflut_layer_pad_set_property (GObject *object, guint prop_id,
+    const GValue *value, GParamSpec *pspec);
+static void gst_pixelflut_layer_pad_get_property (GObject *object, guint prop_id,
+    GValue *value, GParamSpec *pspec);
+static void gst_pixelflut_layer_pad_finalize (GObject *object);
+static GstFlowReturn gst_pixelflut_layer_pad_chain (GstPad *pad, GstObject *parent,
+    GstBuffer *buffer);
+static gboolean gst_pixelflut_layer_pad_event (GstPad *pad, GstObject *parent,
+    GstEvent *event);
+static gboolean gst_pixelflut_layer_pad_activate_mode (GstPad *pad, GstObject *parent,
+    GstPadMode mode, gboolean active);
+
+static void
+gst_pixelflut_layer_pad_class_init (GstPixelflutLayerPadClass *klass)
+{
+  GObjectClass *gobject_class = (GObjectClass *) klass;
+
+  GST_DEBUG_CATEGORY_INIT (pixelflutlayerpad_debug, "pixelflutlayerpad", 0, "pixelflut layer pad");
+
+  gobject_class->set_property = gst_pixelflut_layer_pad_set_property;
+  gobject_class->get_property = gst_pixelflut_layer_pad_get_property;
+  gobject_class->finalize = gst_pixelflut_layer_pad_finalize;
+
+  g_object_class_install_property (gobject_class, PROP_XPOS,
+      g_param_spec_int ("xpos", "X position", "Position of the layer relative to offset-left",
+          G_MININT, G_MAXINT, DEFAULT_XPOS,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_PLAYING));
+  g_object_class_install_property (gobject_class, PROP_YPOS,
+      g_param_spec_int ("ypos", "Y position", "Position of the layer relative to offset-top",
+          G_MININT, G_MAXINT, DEFAULT_YPOS,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_PLAYING));
+  g_object_class_install_property (gobject_class, PROP_ZORDER,
+      g_param_spec_uint ("zorder", "Z-Order",
+          "Stacking order of the layer, the sink pad is at 0", 0, G_MAXUINT, DEFAULT_ZORDER,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_PLAYING));
+}
+
+static void
+gst_pixelflut_layer_pad_init (GstPixelflutLayerPad *pad)
+{
+  pad->xpos = DEFAULT_XPOS;
+  pad->ypos = DEFAULT_YPOS;
+  pad->zorder = DEFAULT_ZORDER;
+
+  gst_video_info_init (&pad->info);
+  pad->have_info = FALSE;
+  gst_segment_init (&pad->segment, GST_FORMAT_TIME);
+  g_queue_init (&pad->queue);
+  pad->current = NULL;
+  pad->flushing = TRUE;
+  pad->eos = FALSE;
+  g_cond_init (&pad->cond);
+
+  gst_pad_set_chain_function (GST_PAD (pad), gst_pixelflut_layer_pad_chain);
+  gst_pad_set_event_function (GST_PAD (pad), gst_pixelflut_layer_pad_event);
+  gst_pad_set_activatemode_function (GST_PAD (pad), gst_pixelflut_layer_pad_activate_mode);
+}
+
+/* A queued frame together with the caps it arrived with */
+typedef struct
+{
+  GstBuffer *buffer;
+  GstVideoInfo info;
+} GstPixelflutLayerFrame;
+
+static void
+gst_pixelflut_layer_frame_free (GstPixelflutLayerFrame *frame)
+{
+  gst_buffer_unref (frame->buffer);
+  g_free (frame);
+}
+
+/* called with the object lock held */
+static void
+gst_pixelflut_layer_pad_clear_locked (GstPixelflutLayerPad *pad)
+{
+  g_queue_foreach (&pad->queue, (GFunc) gst_pixelflut_layer_frame_free, NULL);
+  g_queue_clear (&pad->queue);
+  gst_buffer_replace (&pad->current, NULL);
+  g_cond_broadcast (&pad->cond);
+}
+
+static void
+gst_pixelflut_layer_pad_finalize (GObject *object)
+{
+  GstPixelflutLayerPad *pad = GST_PIXELFLUT_LAYER_PAD (object);
+
+  gst_pixelflut_layer_pad_clear_locked (pad);
+  g_cond_clear (&pad->cond);
+
+  G_OBJECT_CLASS (gst_pixelflut_layer_pad_parent_class)->finalize (object);
+}
+
+static void
+gst_pixelflut_layer_pad_set_property (GObject *object, guint prop_id,
+    const GValue *value, GParamSpec *pspec)
+{
+  GstPixelflutLayerPad *pad = GST_PIXELFLUT_LAYER_PAD (object);
+
+  GST_OBJECT_LOCK (pad);
+  switch (prop_id) {
+    case PROP_XPOS:
+      pad->xpos = g_value_get_int (value);
+      break;
+    case PROP_YPOS:
+      pad->ypos = g_value_get_int (value);
+      break;
+    case PROP_ZORDER:
+      pad->zorder = g_value_get_uint (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+  GST_OBJECT_UNLOCK (pad);
+}
+
+static void
+gst_pixelflut_layer_pad_get_property (GObject *object, guint prop_id,
+    GValue *value, GParamSpec *pspec)
+{
+  GstPixelflutLayerPad *pad = GST_PIXELFLUT_LAYER_PAD (object);
+
+  GST_OBJECT_LOCK (pad);
+  switch (prop_id) {
+    case PROP_XPOS:
+      g_value_set_int (value, pad->xpos);
+      break;
+    case PROP_YPOS:
+      g_value_set_int (value, pad->ypos);
+      break;
+    case PROP_ZORDER:
+      g_value_set_uint (value, pad->zorder);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+  GST_OBJECT_UNLOCK (pad);
+}
+
+static gboolean
+gst_pixelflut_layer_pad_activate_mode (GstPad *gpad, GstObject *parent,
+    GstPadMode mode, gboolean active)
+{
+  GstPixelflutLayerPad *pad = GST_PIXELFLUT_LAYER_PAD (gpad);
+
+  if (mode != GST_PAD_MODE_PUSH)
+    return FALSE;
+
+  GST_OBJECT_LOCK (pad);
+  pad->flushing = !active;
+  pad->eos = FALSE;
+  gst_pixelflut_layer_pad_clear_locked (pad);
+  if (active)
+    gst_segment_init (&pad->segment, GST_FORMAT_TIME);
+  GST_OBJECT_UNLOCK (pad);
+
+  return TRUE;
+}
+
+static GstFlowReturn
+gst_pixelflut_layer_pad_chain (GstPad *gpad, GstObject *parent, GstBuffer *buffer)
+{
+  GstPixelflutLayerPad *pad = GST_PIXELFLUT_LAYER_PAD (gpad);
+  GstPixelflutLayerFrame *frame;
+
+  GST_OBJECT_LOCK (pad);
+  if (!pad->have_info)
+    goto not_negotiated;
+
+  /* the sink takes frames off the queue as its own frames get rendered */
+  while (!pad->flushing && !pad->eos && g_queue_get_length (&pad->queue) >= LAYER_QUEUE_MAX)
+    g_cond_wait (&pad->cond, GST_OBJECT_GET_LOCK (pad));
+
+  if (pad->flushing)
+    goto flushing;
+  if (pad->eos)
+    goto eos;
+
+  frame = g_new0 (GstPixelflutLayerFrame, 1);
+  frame->buffer = buffer;
+  frame->info = pad->info;
+  g_queue_push_tail (&pad->queue, frame);
+  GST_OBJECT_UNLOCK (pad);
+
+  return GST_FLOW_OK;
+
+  /* ERRORS */
+not_negotiated:
+  {
+    GST_OBJECT_UNLOCK (pad);
+    gst_buffer_unref (buffer);
+    return GST_FLOW_NOT_NEGOTIATED;
+  }
+flushing:
+  {
+    GST_OBJECT_UNLOCK (pad);
+    gst_buffer_unref (buffer);
+    return GST_FLOW_FLUSHING;
+  }
+eos:
+  {
+    GST_OBJECT_UNLOCK (pad);
+    gst_buffer_unref (buffer);
+    return GST_FLOW_EOS;
+  }
+}
+
+static gboolean
+gst_pixelflut_layer_pad_event (GstPad *gpad, GstObject *parent, GstEvent *event)
+{
+  GstPixelflutLayerPad *pad = GST_PIXELFLUT_LAYER_PAD (gpad);
+  gboolean ret = TRUE;
+
+  GST_LOG_OBJECT (pad, "%" GST_PTR_FORMAT, event);
+
+  switch (GST_EVENT_TYPE (event)) {
+    case GST_EVENT_CAPS:{
+      GstCaps *caps;
+      GstVideoInfo info;
+
+      gst_event_parse_caps (event, &caps);
+      ret = gst_video_info_from_caps (&info, caps);
+      if (ret) {
+        GST_OBJECT_LOCK (pad);
+        pad->info = info;
+        pad->have_info = TRUE;
+        GST_OBJECT_UNLOCK (pad);
+      }
+      break;
+    }
+    case GST_EVENT_SEGMENT:{
+      const GstSegment *segment;
+
+      gst_event_parse_segment (event, &segment);
+      if (segment->format != GST_FORMAT_TIME) {
+        ret = FALSE;
+        break;
+      }
+      GST_OBJECT_LOCK (pad);
+      gst_segment_copy_into (segment, &pad->segment);
+      GST_OBJECT_UNLOCK (pad);
+      break;
+    }
+    case GST_EVENT_FLUSH_START:
+      GST_OBJECT_LOCK (pad);
+      pad->flushing = TRUE;
+      gst_pixelflut_layer_pad_clear_locked (pad);
+      GST_OBJECT_UNLOCK (pad);
+      break;
+    case GST_EVENT_FLUSH_STOP:
+      GST_OBJECT_LOCK (pad);
+      pad->flushing = FALSE;
+      pad->eos = FALSE;
+      gst_segment_init (&pad->segment, GST_FORMAT_TIME);
+      GST_OBJECT_UNLOCK (pad);
+      break;
+    case GST_EVENT_EOS:
+      /* the last frame stays on the canvas, EOS of the element comes
+       * from the sink pad */
+      GST_OBJECT_LOCK (pad);
+      pad->eos = TRUE;
+      g_cond_broadcast (&pad->cond);
+      GST_OBJECT_UNLOCK (pad);
+      break;
+    default:
+      break;
+  }
+
+  gst_event_unref (event);
+
+  return ret;
+}
+
+/**
+ * gst_pixelflut_layer_pad_get_frame:
+ *
+ * Moves on to the last queued frame due at @running_time of the sink and
+ * returns it with its video @info, or %NULL if there is no frame yet.
+ */
+GstBuffer *
+gst_pixelflut_layer_pad_get_frame (GstPixelflutLayerPad *pad,
+    GstClockTime running_time, GstVideoInfo *info)
+{
+  GstPixelflutLayerFrame *frame;
+  GstBuffer *buffer = NULL;
+
+  GST_OBJECT_LOCK (pad);
+  while ((frame = g_queue_peek_head (&pad->queue))) {
+    GstClockTime ts = gst_segment_to_running_time (&pad->segment, GST_FORMAT_TIME,
+        GST_BUFFER_PTS (frame->buffer));
+
+    /* frames without a time are due right away */
+    if (GST_CLOCK_TIME_IS_VALID (ts) && GST_CLOCK_TIME_IS_VALID (running_time) &&
+        ts > running_time && pad->current)
+      break;
+
+    g_queue_pop_head (&pad->queue);
+    gst_buffer_replace (&pad->current, frame->buffer);
+    pad->current_info = frame->info;
+    gst_pixelflut_layer_frame_free (frame);
+    g_cond_broadcast (&pad->cond);
+  }
+
+  if (pad->current) {
+    buffer = gst_buffer_ref (pad->current);
+    *info = pad->current_info;
+  }
+  GST_OBJECT_UNLOCK (pad);
+
+  return buffer;
+}
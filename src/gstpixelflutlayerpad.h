@@ -0,0 +1,65 @@
+/*
+ * GStreamer Pixelflut
+ * Copyright 2018 Andreas Frisch <fraxinas@schaffenburg.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __GST_PIXELFLUT_LAYER_PAD_H__
+#define __GST_PIXELFLUT_LAYER_PAD_H__
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+
+G_BEGIN_DECLS
+
+#define GST_TYPE_PIXELFLUT_LAYER_PAD gst_pixelflut_layer_pad_get_type ()
+G_DECLARE_FINAL_TYPE (GstPixelflutLayerPad, gst_pixelflut_layer_pad, GST, PIXELFLUT_LAYER_PAD, GstPad)
+
+/**
+ * GstPixelflutLayerPad:
+ *
+ * A request sink pad of pixelflutsink, composited over the frames of the
+ * always sink pad. The frames are queued until the sink renders a frame
+ * with the same or a later running time.
+ */
+struct _GstPixelflutLayerPad
+{
+  GstPad parent;
+
+  /* properties, protected by the object lock */
+  gint xpos;
+  gint ypos;
+  guint zorder;
+
+  /* streaming state, protected by the object lock */
+  GstVideoInfo info;
+  gboolean have_info;
+  GstSegment segment;
+  GQueue queue;
+  GstBuffer *current;
+  GstVideoInfo current_info;
+  gboolean flushing;
+  gboolean eos;
+  GCond cond;
+};
+
+GstBuffer *gst_pixelflut_layer_pad_get_frame (GstPixelflutLayerPad *pad,
+    GstClockTime running_time, GstVideoInfo *info);
+
+G_END_DECLS
+
+#endif /* __GST_PIXELFLUT_LAYER_PAD_H__ */
@@ -0,0 +1,340 @@
+/*
+ * GStreamer Pixelflut
+ * Copyright 2018 Andreas Frisch <fraxinas@schaffenburg.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include <gio/gio.h>
+
+#include "gstpixelflutlut.h"
+
+/* the largest cube the .cube format allows */
+#define CUBE_SIZE_MAX 256
+#define LUT_1D_SIZE_MAX 65536
+
+static void
+gst_pixelflut_lut_set_hex (GstPixelflutLut *lut, guint8 table[3][256])
+{
+  static const gchar digits[] = "0123456789abcdef";
+  guint c, v;
+
+  for (c = 0; c < 3; c++) {
+    for (v = 0; v < 256; v++) {
+      lut->hex[c][v][0] = digits[table[c][v] >> 4];
+      lut->hex[c][v][1] = digits[table[c][v] & 0xf];
+    }
+  }
+}
+
+static gpointer
+gst_pixelflut_lut_init_identity (gpointer data)
+{
+  static GstPixelflutLut identity;
+  guint8 table[3][256];
+  guint c, v;
+
+  for (c = 0; c < 3; c++)
+    for (v = 0; v < 256; v++)
+      table[c][v] = v;
+
+  gst_pixelflut_lut_set_hex (&identity, table);
+  identity.size = 0;
+  identity.cube = NULL;
+
+  return &identity;
+}
+
+/**
+ * gst_pixelflut_lut_get_identity:
+ *
+ * Returns: a LUT that leaves the colors alone, for formatting pixels the
+ * same way with and without correction
+ */
+const GstPixelflutLut *
+gst_pixelflut_lut_get_identity (void)
+{
+  static GOnce once = G_ONCE_INIT;
+
+  return g_once (&once, gst_pixelflut_lut_init_identity, NULL);
+}
+
+static guint8
+gst_pixelflut_lut_to_byte (gdouble value)
+{
+  return CLAMP (value, 0.0, 1.0) * 255.0 + 0.5;
+}
+
+/* Three rows of 256 values 0-255 for red, green and blue */
+static GstPixelflutLut *
+gst_pixelflut_lut_parse_table (const gchar *contents, const gchar *location,
+    GError **err)
+{
+  GstPixelflutLut *lut;
+  guint8 table[3][256];
+  const gchar *p = contents;
+  guint n = 0;
+
+  while (*p) {
+    gchar *end;
+    gint64 value;
+
+    if (g_ascii_isspace (*p) || *p == ',') {
+      p++;
+      continue;
+    }
+    if (*p == '#') {
+      while (*p && *p != '\n')
+        p++;
+      continue;
+    }
+
+    value = g_ascii_strtoll (p, &end, 10);
+    if (end == p || value < 0 || value > 255 || n >= 3 * 256)
+      goto invalid;
+    table[n / 256][n % 256] = value;
+    n++;
+    p = end;
+  }
+  if (n != 3 * 256)
+    goto invalid;
+
+  lut = g_new0 (GstPixelflutLut, 1);
+  gst_pixelflut_lut_set_hex (lut, table);
+
+  return lut;
+
+invalid:
+  {
+    g_set_error (err, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+        "%s is not a table of 3x256 values from 0 to 255", location);
+    return NULL;
+  }
+}
+
+/* Reads the numbers following a keyword */
+static gboolean
+gst_pixelflut_lut_parse_numbers (const gchar *str, gdouble *values, guint n)
+{
+  guint i;
+
+  for (i = 0; i < n; i++) {
+    gchar *end;
+
+    values[i] = g_ascii_strtod (str, &end);
+    if (end == str)
+      return FALSE;
+    str = end;
+  }
+
+  while (g_ascii_isspace (*str))
+    str++;
+
+  return *str == '\0';
+}
+
+/* Where @value, 0-1, lies in a LUT of @size entries covering @min to @max */
+static gdouble
+gst_pixelflut_lut_position (gdouble value, gdouble min, gdouble max, guint size)
+{
+  if (max <= min)
+    return 0;
+
+  return CLAMP ((value - min) / (max - min), 0.0, 1.0) * (size - 1);
+}
+
+/* Adobe/Resolve .cube files with a 1D LUT, a 3D LUT or a 1D shaper
+ * followed by a 3D LUT */
+static GstPixelflutLut *
+gst_pixelflut_lut_parse_cube (const gchar *contents, const gchar *location,
+    GError **err)
+{
+  GstPixelflutLut *lut = NULL;
+  gchar **lines;
+  GArray *values;
+  guint size_1d = 0, size_3d = 0;
+  gdouble domain_min[3] = { 0.0, 0.0, 0.0 }, domain_max[3] = { 1.0, 1.0, 1.0 };
+  gdouble range_1d[2] = { -1.0, -1.0 }, range_3d[2] = { -1.0, -1.0 };
+  gdouble shaper[3][256];
+  guint8 table[3][256];
+  const gfloat *data_1d, *data_3d;
+  guint i, c, v;
+
+  values = g_array_new (FALSE, FALSE, sizeof (gfloat));
+  lines = g_strsplit (contents, "\n", -1);
+
+  for (i = 0; lines[i]; i++) {
+    gchar *line = g_strstrip (lines[i]);
+    gdouble numbers[3];
+
+    if (!*line || *line == '#')
+      continue;
+
+    if (g_str_has_prefix (line, "TITLE")) {
+      continue;
+    } else if (g_str_has_prefix (line, "LUT_1D_SIZE")) {
+      if (!gst_pixelflut_lut_parse_numbers (line + 11, numbers, 1) ||
+          numbers[0] < 2 || numbers[0] > LUT_1D_SIZE_MAX)
+        goto invalid;
+      size_1d = numbers[0];
+    } else if (g_str_has_prefix (line, "LUT_3D_SIZE")) {
+      if (!gst_pixelflut_lut_parse_numbers (line + 11, numbers, 1) ||
+          numbers[0] < 2 || numbers[0] > CUBE_SIZE_MAX)
+        goto invalid;
+      size_3d = numbers[0];
+    } else if (g_str_has_prefix (line, "DOMAIN_MIN")) {
+      if (!gst_pixelflut_lut_parse_numbers (line + 10, domain_min, 3))
+        goto invalid;
+    } else if (g_str_has_prefix (line, "DOMAIN_MAX")) {
+      if (!gst_pixelflut_lut_parse_numbers (line + 10, domain_max, 3))
+        goto invalid;
+    } else if (g_str_has_prefix (line, "LUT_1D_INPUT_RANGE")) {
+      if (!gst_pixelflut_lut_parse_numbers (line + 18, range_1d, 2))
+        goto invalid;
+    } else if (g_str_has_prefix (line, "LUT_3D_INPUT_RANGE")) {
+      if (!gst_pixelflut_lut_parse_numbers (line + 18, range_3d, 2))
+        goto invalid;
+    } else if (g_ascii_isalpha (*line)) {
+      /* unknown keyword */
+      continue;
+    } else {
+      gfloat entry[3];
+
+      if (!gst_pixelflut_lut_parse_numbers (line, numbers, 3))
+        goto invalid;
+      entry[0] = numbers[0];
+      entry[1] = numbers[1];
+      entry[2] = numbers[2];
+      g_array_append_vals (values, entry, 3);
+    }
+  }
+
+  if ((!size_1d && !size_3d) ||
+      values->len != 3 * (size_1d + size_3d * size_3d * size_3d))
+    goto invalid;
+
+  data_1d = (const gfloat *) values->data;
+  data_3d = data_1d + 3 * size_1d;
+
+  /* the 1D part, or what goes into the cube */
+  for (c = 0; c < 3; c++) {
+    gdouble min = range_1d[0] < range_1d[1] ? range_1d[0] : domain_min[c];
+    gdouble max = range_1d[0] < range_1d[1] ? range_1d[1] : domain_max[c];
+
+    for (v = 0; v < 256; v++) {
+      gdouble pos, frac;
+      guint idx;
+
+      if (!size_1d) {
+        shaper[c][v] = v / 255.0;
+        continue;
+      }
+      pos = gst_pixelflut_lut_position (v / 255.0, min, max, size_1d);
+      idx = MIN ((guint) pos, size_1d - 2);
+      frac = pos - idx;
+      shaper[c][v] = data_1d[3 * idx + c] * (1.0 - frac) +
+          data_1d[3 * (idx + 1) + c] * frac;
+    }
+  }
+
+  lut = g_new0 (GstPixelflutLut, 1);
+
+  if (size_3d) {
+    gsize n = (gsize) size_3d * size_3d * size_3d;
+
+    /* zeroed room for the neighbours of the last entries, which are read
+     * with a weight of 0 */
+    lut->size = size_3d;
+    lut->cube = g_malloc0 (3 * (n + size_3d * size_3d + size_3d + 1));
+    for (i = 0; i < 3 * n; i++)
+      lut->cube[i] = gst_pixelflut_lut_to_byte (data_3d[i]);
+
+    for (c = 0; c < 3; c++) {
+      gdouble min = range_3d[0] < range_3d[1] ? range_3d[0] : domain_min[c];
+      gdouble max = range_3d[0] < range_3d[1] ? range_3d[1] : domain_max[c];
+
+      for (v = 0; v < 256; v++)
+        lut->pos[c][v] = gst_pixelflut_lut_position (shaper[c][v], min, max,
+            size_3d) * 256.0 + 0.5;
+    }
+
+    for (c = 0; c < 3; c++)
+      for (v = 0; v < 256; v++)
+        table[c][v] = v;
+  } else {
+    for (c = 0; c < 3; c++)
+      for (v = 0; v < 256; v++)
+        table[c][v] = gst_pixelflut_lut_to_byte (shaper[c][v]);
+  }
+  gst_pixelflut_lut_set_hex (lut, table);
+
+  g_strfreev (lines);
+  g_array_free (values, TRUE);
+
+  return lut;
+
+invalid:
+  {
+    g_set_error (err, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+        "%s: invalid .cube file at line %u", location, lines[i] ? i + 1 : i);
+    g_strfreev (lines);
+    g_array_free (values, TRUE);
+    return NULL;
+  }
+}
+
+/**
+ * gst_pixelflut_lut_load:
+ *
+ * Loads a .cube file or, for any other file name, three rows of 256
+ * values for red, green and blue.
+ *
+ * Returns: the LUT or %NULL with @err set
+ */
+GstPixelflutLut *
+gst_pixelflut_lut_load (const gchar *location, GError **err)
+{
+  GstPixelflutLut *lut;
+  gchar *contents;
+
+  if (!g_file_get_contents (location, &contents, NULL, err))
+    return NULL;
+
+  if (g_str_has_suffix (location, ".cube") || g_str_has_suffix (location, ".CUBE"))
+    lut = gst_pixelflut_lut_parse_cube (contents, location, err);
+  else
+    lut = gst_pixelflut_lut_parse_table (contents, location, err);
+
+  g_free (contents);
+
+  return lut;
+}
+
+void
+gst_pixelflut_lut_free (GstPixelflutLut *lut)
+{
+  if (!lut)
+    return;
+
+  g_free (lut->cube);
+  g_free (lut);
+}
@@ -0,0 +1,105 @@
+/*
+ * GStreamer Pixelflut
+ * Copyright 2018 Andreas Frisch <fraxinas@schaffenburg.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __GST_PIXELFLUT_LUT_H__
+#define __GST_PIXELFLUT_LUT_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/**
+ * GstPixelflutLut:
+ *
+ * Color correction applied while encoding. The per channel correction is
+ * baked into the hex digits written for each channel value, so it costs
+ * nothing. An optional 3D LUT is interpolated before that, with the
+ * position of each input value in the cube precomputed.
+ */
+typedef struct
+{
+  /* two hex digits for each channel value */
+  gchar hex[3][256][2];
+
+  /* 3D LUT of size^3 RGB entries, red changing fastest, or NULL */
+  guint size;
+  guint8 *cube;
+  /* position of each input value in the cube, 8 fractional bits */
+  guint pos[3][256];
+} GstPixelflutLut;
+
+const GstPixelflutLut *gst_pixelflut_lut_get_identity (void);
+GstPixelflutLut *gst_pixelflut_lut_load (const gchar *location, GError **err);
+void gst_pixelflut_lut_free (GstPixelflutLut *lut);
+
+static inline guint
+gst_pixelflut_lut_lerp (guint a, guint b, guint frac)
+{
+  return (a * (256 - frac) + b * frac + 128) >> 8;
+}
+
+/* Trilinear interpolation in the cube, @pixel is 0xRRGGBBAA */
+static inline guint32
+gst_pixelflut_lut_apply_cube (const GstPixelflutLut *lut, guint32 pixel)
+{
+  guint pr = lut->pos[0][pixel >> 24];
+  guint pg = lut->pos[1][(pixel >> 16) & 0xff];
+  guint pb = lut->pos[2][(pixel >> 8) & 0xff];
+  guint fr = pr & 0xff, fg = pg & 0xff, fb = pb & 0xff;
+  gsize n = lut->size;
+  const guint8 *c000 = lut->cube + 3 * (((pb >> 8) * n + (pg >> 8)) * n + (pr >> 8));
+  const guint8 *c010 = c000 + 3 * n;
+  const guint8 *c001 = c000 + 3 * n * n;
+  const guint8 *c011 = c001 + 3 * n;
+  guint32 out = pixel & 0xff;
+  gint c;
+
+  for (c = 0; c < 3; c++) {
+    guint v00 = gst_pixelflut_lut_lerp (c000[c], c000[3 + c], fr);
+    guint v10 = gst_pixelflut_lut_lerp (c010[c], c010[3 + c], fr);
+    guint v01 = gst_pixelflut_lut_lerp (c001[c], c001[3 + c], fr);
+    guint v11 = gst_pixelflut_lut_lerp (c011[c], c011[3 + c], fr);
+    guint v0 = gst_pixelflut_lut_lerp (v00, v10, fg);
+    guint v1 = gst_pixelflut_lut_lerp (v01, v11, fg);
+
+    out |= gst_pixelflut_lut_lerp (v0, v1, fb) << (24 - 8 * c);
+  }
+
+  return out;
+}
+
+/* Writes the six corrected hex digits of @pixel, 0xRRGGBBAA, to @out */
+static inline void
+gst_pixelflut_lut_format (const GstPixelflutLut *lut, guint32 pixel, gchar *out)
+{
+  if (lut->cube)
+    pixel = gst_pixelflut_lut_apply_cube (lut, pixel);
+
+  out[0] = lut->hex[0][pixel >> 24][0];
+  out[1] = lut->hex[0][pixel >> 24][1];
+  out[2] = lut->hex[1][(pixel >> 16) & 0xff][0];
+  out[3] = lut->hex[1][(pixel >> 16) & 0xff][1];
+  out[4] = lut->hex[2][(pixel >> 8) & 0xff][0];
+  out[5] = lut->hex[2][(pixel >> 8) & 0xff][1];
+}
+
+G_END_DECLS
+
+#endif /* __GST_PIXELFLUT_LUT_H__ */
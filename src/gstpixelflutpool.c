@@ -0,0 +1,1041 @@
+/*
+ * GStreamer Pixelflut
+ * Copyright 2018 Andreas Frisch <fraxinas@schaffenburg.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#ifdef HAVE_IFADDRS_H
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <ifaddrs.h>
+#endif
+
+#include "gstpixelflutpool.h"
+
+GST_DEBUG_CATEGORY_STATIC (pixelflutpool_debug);
+#define GST_CAT_DEFAULT pixelflutpool_debug
+
+G_DEFINE_TYPE (GstPixelflutPool, gst_pixelflut_pool, GST_TYPE_OBJECT);
+
+/* bounds for the exponential backoff between failed standby connects */
+#define BACKOFF_MIN (100 * G_TIME_SPAN_MILLISECOND)
+#define BACKOFF_MAX (10 * G_TIME_SPAN_SECOND)
+
+/* A local address or, with prefix_len shorter than the address, a range
+ * to pick random addresses from */
+typedef struct
+{
+  GInetAddress *address;
+  guint prefix_len;
+} GstPixelflutBindAddress;
+
+/* shared by all pools, so that several sinks in one process don't
+ * all start with the first address */
+static gint bind_counter = 0;
+
+/* pools shared by host and port across all pipelines of the process,
+ * holding weak references so that unused pools go away */
+G_LOCK_DEFINE_STATIC (shared_pools);
+static GHashTable *shared_pools = NULL;
+
+/* One connection attempt, from connecting up to the SIZE reply */
+typedef struct
+{
+  GstPixelflutPool *pool;
+  gchar *name;
+  GSocketClient *client;
+  GCancellable *cancellable;
+  GSource *timeout_source;
+  gboolean timed_out;
+  GSocketConnection *connection;
+  GDataInputStream *istream;
+} GstPixelflutAttempt;
+
+static void gst_pixelflut_pool_finalize (GObject *object);
+static void gst_pixelflut_pool_replenish_locked (GstPixelflutPool *pool);
+
+static void
+gst_pixelflut_pool_class_init (GstPixelflutPoolClass *klass)
+{
+  GObjectClass *gobject_class = (GObjectClass *) klass;
+
+  GST_DEBUG_CATEGORY_INIT (pixelflutpool_debug, "pixelflutpool", 0, "pixelflut connection pool");
+
+  gobject_class->finalize = gst_pixelflut_pool_finalize;
+}
+
+static void
+gst_pixelflut_pool_init (GstPixelflutPool *pool)
+{
+  pool->host = NULL;
+  pool->port = 0;
+  pool->canvas_width = 0;
+  pool->canvas_height = 0;
+  pool->connect_timeout = GST_CLOCK_TIME_NONE;
+  pool->bind_addresses = NULL;
+  pool->server_address = NULL;
+
+  pool->n_standby = 0;
+  g_queue_init (&pool->ready);
+  pool->attempts = NULL;
+  pool->waiters = 0;
+  pool->primed = FALSE;
+  pool->connected = FALSE;
+  pool->error = NULL;
+  pool->backoff = 0;
+  pool->retry_source = NULL;
+  pool->resolving = FALSE;
+  pool->running = FALSE;
+  pool->users = 0;
+  g_cond_init (&pool->cond);
+
+  pool->shared = NULL;
+  pool->leased = FALSE;
+  g_queue_init (&pool->lessees);
+
+  pool->cancellable = g_cancellable_new ();
+  pool->context = NULL;
+  pool->loop = NULL;
+  pool->thread = NULL;
+}
+
+static void
+gst_pixelflut_pool_finalize (GObject *object)
+{
+  GstPixelflutPool *pool = GST_PIXELFLUT_POOL (object);
+
+  gst_pixelflut_pool_stop (pool);
+
+  g_cond_clear (&pool->cond);
+  g_clear_error (&pool->error);
+  g_clear_object (&pool->cancellable);
+  g_clear_pointer (&pool->bind_addresses, g_ptr_array_unref);
+  g_clear_object (&pool->server_address);
+  g_free (pool->host);
+
+  G_OBJECT_CLASS (gst_pixelflut_pool_parent_class)->finalize (object);
+}
+
+GstPixelflutPool *
+gst_pixelflut_pool_new (const gchar *host, gint port)
+{
+  GstPixelflutPool *pool;
+
+  pool = g_object_new (GST_TYPE_PIXELFLUT_POOL, NULL);
+  gst_object_ref_sink (pool);
+  pool->host = g_strdup (host);
+  pool->port = port;
+
+  return pool;
+}
+
+static void
+gst_pixelflut_weak_ref_free (GWeakRef *ref)
+{
+  g_weak_ref_clear (ref);
+  g_free (ref);
+}
+
+/**
+ * gst_pixelflut_pool_get_shared:
+ *
+ * Returns the pool for @host and @port used by the other sinks of the
+ * process, or a new one which they will find.
+ */
+GstPixelflutPool *
+gst_pixelflut_pool_get_shared (const gchar *host, gint port)
+{
+  GstPixelflutPool *pool;
+  GWeakRef *ref;
+  gchar *key;
+
+  key = g_strdup_printf ("%s:%d", host, port);
+
+  G_LOCK (shared_pools);
+  if (!shared_pools)
+    shared_pools = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+        (GDestroyNotify) gst_pixelflut_weak_ref_free);
+
+  ref = g_hash_table_lookup (shared_pools, key);
+  pool = ref ? g_weak_ref_get (ref) : NULL;
+  if (!pool) {
+    pool = gst_pixelflut_pool_new (host, port);
+    ref = g_new0 (GWeakRef, 1);
+    g_weak_ref_init (ref, pool);
+    g_hash_table_replace (shared_pools, key, ref);
+    GST_DEBUG_OBJECT (pool, "new shared pool for %s", key);
+  } else {
+    g_free (key);
+  }
+  G_UNLOCK (shared_pools);
+
+  return pool;
+}
+
+static void
+gst_pixelflut_bind_address_free (GstPixelflutBindAddress *bind)
+{
+  g_object_unref (bind->address);
+  g_free (bind);
+}
+
+static void
+gst_pixelflut_pool_add_bind_address (GPtrArray *array, GInetAddress *address,
+    guint prefix_len)
+{
+  GstPixelflutBindAddress *bind = g_new0 (GstPixelflutBindAddress, 1);
+
+  bind->address = g_object_ref (address);
+  bind->prefix_len = prefix_len;
+  g_ptr_array_add (array, bind);
+}
+
+/* All usable addresses of a network interface, which includes the
+ * temporary IPv6 privacy addresses */
+static gboolean
+gst_pixelflut_pool_add_interface (GPtrArray *array, const gchar *name, GError **err)
+{
+#ifdef HAVE_IFADDRS_H
+  struct ifaddrs *ifaddrs, *ifa;
+  guint found = 0;
+
+  if (getifaddrs (&ifaddrs) != 0) {
+    g_set_error (err, G_IO_ERROR, G_IO_ERROR_FAILED,
+        "Could not list the network interfaces");
+    return FALSE;
+  }
+
+  for (ifa = ifaddrs; ifa; ifa = ifa->ifa_next) {
+    GSocketAddress *sockaddr;
+    GInetAddress *address;
+    gsize len;
+
+    if (!ifa->ifa_addr || strcmp (ifa->ifa_name, name) != 0)
+      continue;
+    if (ifa->ifa_addr->sa_family == AF_INET)
+      len = sizeof (struct sockaddr_in);
+    else if (ifa->ifa_addr->sa_family == AF_INET6)
+      len = sizeof (struct sockaddr_in6);
+    else
+      continue;
+
+    sockaddr = g_socket_address_new_from_native (ifa->ifa_addr, len);
+    if (!sockaddr)
+      continue;
+    address = g_inet_socket_address_get_address (G_INET_SOCKET_ADDRESS (sockaddr));
+    /* link-local addresses don't reach any server */
+    if (!g_inet_address_get_is_link_local (address)) {
+      gst_pixelflut_pool_add_bind_address (array, address,
+          g_inet_address_get_native_size (address) * 8);
+      found++;
+    }
+    g_object_unref (sockaddr);
+  }
+  freeifaddrs (ifaddrs);
+
+  if (!found) {
+    g_set_error (err, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+        "No usable address on interface '%s'", name);
+    return FALSE;
+  }
+
+  return TRUE;
+#else
+  g_set_error (err, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+      "'%s' is no address, and interfaces aren't supported on this platform", name);
+  return FALSE;
+#endif
+}
+
+/**
+ * gst_pixelflut_pool_set_bind_addresses:
+ *
+ * Sets the local addresses to connect from, a comma separated list of
+ * addresses, address ranges like 2001:db8::/64 or interface names. Each
+ * new connection uses the next one, ranges yield a random address each
+ * time. %NULL or an empty string lets the system choose.
+ */
+gboolean
+gst_pixelflut_pool_set_bind_addresses (GstPixelflutPool *pool,
+    const gchar *addresses, GError **err)
+{
+  GPtrArray *array;
+  gchar **entries;
+  guint i;
+
+  array = g_ptr_array_new_with_free_func ((GDestroyNotify) gst_pixelflut_bind_address_free);
+  entries = g_strsplit (addresses ? addresses : "", ",", -1);
+
+  for (i = 0; entries[i]; i++) {
+    gchar *entry = g_strstrip (entries[i]);
+    GInetAddress *address;
+    GInetAddressMask *mask;
+
+    if (!*entry)
+      continue;
+
+    if ((address = g_inet_address_new_from_string (entry))) {
+      gst_pixelflut_pool_add_bind_address (array, address,
+          g_inet_address_get_native_size (address) * 8);
+      g_object_unref (address);
+    } else if (strchr (entry, '/')) {
+      mask = g_inet_address_mask_new_from_string (entry, err);
+      if (!mask)
+        goto failed;
+      gst_pixelflut_pool_add_bind_address (array,
+          g_inet_address_mask_get_address (mask), g_inet_address_mask_get_length (mask));
+      g_object_unref (mask);
+    } else if (!gst_pixelflut_pool_add_interface (array, entry, err)) {
+      goto failed;
+    }
+  }
+  g_strfreev (entries);
+
+  for (i = 0; i < array->len; i++) {
+    GstPixelflutBindAddress *bind = g_ptr_array_index (array, i);
+    gchar *str = g_inet_address_to_string (bind->address);
+    GST_DEBUG_OBJECT (pool, "binding to %s/%u", str, bind->prefix_len);
+    g_free (str);
+  }
+
+  GST_OBJECT_LOCK (pool);
+  g_clear_pointer (&pool->bind_addresses, g_ptr_array_unref);
+  if (array->len)
+    pool->bind_addresses = array;
+  else
+    g_ptr_array_unref (array);
+  GST_OBJECT_UNLOCK (pool);
+
+  return TRUE;
+
+failed:
+  g_strfreev (entries);
+  g_ptr_array_unref (array);
+  return FALSE;
+}
+
+/* The next local address of @family in turn, or %NULL. Called with the
+ * object lock held. */
+static GSocketAddress *
+gst_pixelflut_pool_next_bind_address_locked (GstPixelflutPool *pool,
+    GSocketFamily family)
+{
+  GstPixelflutBindAddress *bind = NULL;
+  GSocketAddress *sockaddr;
+  GInetAddress *address;
+  guint8 bytes[16];
+  guint i, n = 0, pick, size, bit;
+
+  if (!pool->bind_addresses)
+    return NULL;
+
+  for (i = 0; i < pool->bind_addresses->len; i++) {
+    GstPixelflutBindAddress *b = g_ptr_array_index (pool->bind_addresses, i);
+    n += (g_inet_address_get_family (b->address) == family);
+  }
+  if (!n)
+    return NULL;
+
+  pick = (guint) g_atomic_int_add (&bind_counter, 1) % n;
+  for (i = 0; i < pool->bind_addresses->len; i++) {
+    GstPixelflutBindAddress *b = g_ptr_array_index (pool->bind_addresses, i);
+    if (g_inet_address_get_family (b->address) == family && pick-- == 0) {
+      bind = b;
+      break;
+    }
+  }
+
+  /* randomize the host part of a range, which in IPv4 ranges of more
+   * than two addresses mustn't be the network or broadcast address */
+  size = g_inet_address_get_native_size (bind->address);
+  memcpy (bytes, g_inet_address_to_bytes (bind->address), size);
+  for (;;) {
+    guint ones = 0;
+
+    for (bit = bind->prefix_len; bit < size * 8; bit++) {
+      if (g_random_boolean ()) {
+        bytes[bit / 8] |= 0x80 >> (bit % 8);
+        ones++;
+      } else {
+        bytes[bit / 8] &= ~(0x80 >> (bit % 8));
+      }
+    }
+    if (family != G_SOCKET_FAMILY_IPV4 || bind->prefix_len > 30 ||
+        (ones != 0 && ones != size * 8 - bind->prefix_len))
+      break;
+  }
+
+  address = g_inet_address_new_from_bytes (bytes, family);
+  sockaddr = g_inet_socket_address_new (address, 0);
+  g_object_unref (address);
+
+  return sockaddr;
+}
+
+void
+gst_pixelflut_connection_free (GstPixelflutConnection *conn)
+{
+  GError *err = NULL;
+
+  if (!conn)
+    return;
+
+  /* the output stream belongs to the connection */
+  if (!g_io_stream_close (G_IO_STREAM (conn->connection), NULL, &err)) {
+    GST_DEBUG ("Failed to close socket: %s", err->message);
+    g_clear_error (&err);
+  }
+  g_object_unref (conn->connection);
+  g_free (conn);
+}
+
+/* called with the object lock held, in the pool thread */
+static void
+gst_pixelflut_pool_maybe_quit_locked (GstPixelflutPool *pool)
+{
+  if (!pool->running && !pool->attempts && !pool->resolving)
+    g_main_loop_quit (pool->loop);
+}
+
+static guint
+gst_pixelflut_pool_needed_locked (GstPixelflutPool *pool)
+{
+  /* until the first connection was taken, one more is expected */
+  return pool->n_standby + pool->waiters + (pool->primed ? 0 : 1);
+}
+
+static void
+gst_pixelflut_pool_attempt_free (GstPixelflutAttempt *attempt)
+{
+  if (attempt->timeout_source) {
+    g_source_destroy (attempt->timeout_source);
+    g_source_unref (attempt->timeout_source);
+  }
+  if (attempt->connection) {
+    g_io_stream_close (G_IO_STREAM (attempt->connection), NULL, NULL);
+    g_object_unref (attempt->connection);
+  }
+  g_clear_object (&attempt->istream);
+  g_clear_object (&attempt->client);
+  g_clear_object (&attempt->cancellable);
+  gst_object_unref (attempt->pool);
+  g_free (attempt->name);
+  g_free (attempt);
+}
+
+static void
+gst_pixelflut_pool_attempt_done (GstPixelflutAttempt *attempt,
+    GstPixelflutConnection *conn, GError *err)
+{
+  GstPixelflutPool *pool = attempt->pool;
+
+  if (err && attempt->timed_out && g_error_matches (err, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+    g_clear_error (&err);
+    err = g_error_new (G_IO_ERROR, G_IO_ERROR_TIMED_OUT,
+        "Timed out connecting to %s", attempt->name);
+  }
+
+  GST_OBJECT_LOCK (pool);
+  pool->attempts = g_list_remove (pool->attempts, attempt);
+
+  if (conn) {
+    GST_DEBUG_OBJECT (pool, "connection to %s ready", attempt->name);
+    if (!pool->server_address)
+      pool->server_address = g_socket_connection_get_remote_address (conn->connection, NULL);
+    pool->connected = TRUE;
+    pool->backoff = 0;
+    if (pool->running &&
+        g_queue_get_length (&pool->ready) < gst_pixelflut_pool_needed_locked (pool)) {
+      g_queue_push_tail (&pool->ready, conn);
+      conn = NULL;
+    }
+    g_cond_broadcast (&pool->cond);
+  } else if (!pool->running) {
+    GST_DEBUG_OBJECT (pool, "attempt to %s stopped", attempt->name);
+  } else if (pool->connected) {
+    pool->backoff = pool->backoff ? MIN (2 * pool->backoff, BACKOFF_MAX) : BACKOFF_MIN;
+    GST_INFO_OBJECT (pool, "connection to %s failed, retrying in %" G_GINT64_FORMAT
+        " ms: %s", attempt->name, pool->backoff / G_TIME_SPAN_MILLISECOND, err->message);
+  } else {
+    GST_INFO_OBJECT (pool, "connection to %s failed: %s", attempt->name, err->message);
+    if (!pool->attempts && !pool->resolving) {
+      /* none of the addresses worked out */
+      if (!pool->error)
+        pool->error = g_error_copy (err);
+      g_cond_broadcast (&pool->cond);
+    }
+  }
+
+  gst_pixelflut_pool_replenish_locked (pool);
+  gst_pixelflut_pool_maybe_quit_locked (pool);
+  GST_OBJECT_UNLOCK (pool);
+
+  /* surplus connection from the parallel initial connect */
+  gst_pixelflut_connection_free (conn);
+  g_clear_error (&err);
+  gst_pixelflut_pool_attempt_free (attempt);
+}
+
+static void
+gst_pixelflut_pool_size_received (GObject *source, GAsyncResult *res, gpointer data)
+{
+  GstPixelflutAttempt *attempt = data;
+  GstPixelflutPool *pool = attempt->pool;
+  GstPixelflutConnection *conn;
+  GError *err = NULL;
+  gchar *readbuf;
+  gsize rret;
+  gint x, y;
+
+  readbuf = g_data_input_stream_read_line_finish_utf8 (attempt->istream, res, &rret, &err);
+  if (!readbuf) {
+    if (!err)
+      err = g_error_new (GST_RESOURCE_ERROR, GST_RESOURCE_ERROR_READ,
+          "Couldn't receive SIZE reply from %s", attempt->name);
+    gst_pixelflut_pool_attempt_done (attempt, NULL, err);
+    return;
+  }
+
+  if (sscanf (readbuf, "SIZE %d%d", &x, &y) != 2 || x < 0 || y < 0) {
+    err = g_error_new (GST_RESOURCE_ERROR, GST_RESOURCE_ERROR_READ,
+        "Couldn't parse canvas reply '%s' from %s", readbuf, attempt->name);
+    g_free (readbuf);
+    gst_pixelflut_pool_attempt_done (attempt, NULL, err);
+    return;
+  }
+  g_free (readbuf);
+
+  GST_OBJECT_LOCK (pool);
+  pool->canvas_width = x;
+  pool->canvas_height = y;
+  GST_OBJECT_UNLOCK (pool);
+
+  conn = g_new0 (GstPixelflutConnection, 1);
+  conn->connection = attempt->connection;
+  conn->ostream = g_io_stream_get_output_stream (G_IO_STREAM (conn->connection));
+  attempt->connection = NULL;
+
+  gst_pixelflut_pool_attempt_done (attempt, conn, NULL);
+}
+
+static void
+gst_pixelflut_pool_connected (GObject *source, GAsyncResult *res, gpointer data)
+{
+  GstPixelflutAttempt *attempt = data;
+  GOutputStream *ostream;
+  GError *err = NULL;
+
+  attempt->connection = g_socket_client_connect_finish (G_SOCKET_CLIENT (source), res, &err);
+  if (!attempt->connection) {
+    gst_pixelflut_pool_attempt_done (attempt, NULL, err);
+    return;
+  }
+
+  GST_DEBUG_OBJECT (attempt->pool, "connected to %s, sending SIZE", attempt->name);
+
+  /* pipeline the handshake right behind the connect, the reply is
+   * collected asynchronously */
+  ostream = g_io_stream_get_output_stream (G_IO_STREAM (attempt->connection));
+  if (!g_output_stream_write_all (ostream, "SIZE\n", 5, NULL, attempt->cancellable, &err)) {
+    gst_pixelflut_pool_attempt_done (attempt, NULL, err);
+    return;
+  }
+
+  attempt->istream = g_data_input_stream_new (
+      g_io_stream_get_input_stream (G_IO_STREAM (attempt->connection)));
+  g_data_input_stream_read_line_async (attempt->istream, G_PRIORITY_DEFAULT,
+      attempt->cancellable, gst_pixelflut_pool_size_received, attempt);
+}
+
+static gboolean
+gst_pixelflut_pool_attempt_timeout (gpointer data)
+{
+  GstPixelflutAttempt *attempt = data;
+
+  GST_DEBUG_OBJECT (attempt->pool, "connecting to %s timed out", attempt->name);
+  attempt->timed_out = TRUE;
+  g_cancellable_cancel (attempt->cancellable);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* called with the object lock held, in the pool thread */
+static void
+gst_pixelflut_pool_attempt_start (GstPixelflutPool *pool,
+    GSocketConnectable *connectable, const gchar *name)
+{
+  GstPixelflutAttempt *attempt;
+
+  attempt = g_new0 (GstPixelflutAttempt, 1);
+  attempt->pool = gst_object_ref (pool);
+  attempt->name = g_strdup (name);
+  attempt->cancellable = g_cancellable_new ();
+  attempt->client = g_socket_client_new ();
+
+  /* the family of a host name is only known once it was resolved */
+  if (G_IS_INET_SOCKET_ADDRESS (connectable)) {
+    GSocketAddress *local = gst_pixelflut_pool_next_bind_address_locked (pool,
+        g_socket_address_get_family (G_SOCKET_ADDRESS (connectable)));
+    if (local) {
+      gchar *str = g_inet_address_to_string (
+          g_inet_socket_address_get_address (G_INET_SOCKET_ADDRESS (local)));
+      GST_DEBUG_OBJECT (pool, "connecting from %s", str);
+      g_socket_client_set_local_address (attempt->client, local);
+      g_object_unref (local);
+      g_free (str);
+    }
+  }
+
+  if (GST_CLOCK_TIME_IS_VALID (pool->connect_timeout)) {
+    attempt->timeout_source =
+        g_timeout_source_new (GST_TIME_AS_MSECONDS (pool->connect_timeout));
+    g_source_set_callback (attempt->timeout_source,
+        gst_pixelflut_pool_attempt_timeout, attempt, NULL);
+    g_source_attach (attempt->timeout_source, pool->context);
+  }
+
+  GST_DEBUG_OBJECT (pool, "connecting to %s", name);
+  pool->attempts = g_list_prepend (pool->attempts, attempt);
+  g_socket_client_connect_async (attempt->client, connectable, attempt->cancellable,
+      gst_pixelflut_pool_connected, attempt);
+}
+
+/* called with the object lock held, in the pool thread */
+static void
+gst_pixelflut_pool_attempt_start_host (GstPixelflutPool *pool)
+{
+  GSocketConnectable *connectable;
+
+  /* GSocketClient races the addresses of the host itself, but binding
+   * needs to know the address family up front */
+  if (pool->bind_addresses && pool->server_address)
+    connectable = G_SOCKET_CONNECTABLE (g_object_ref (pool->server_address));
+  else
+    connectable = g_network_address_new (pool->host, pool->port);
+  gst_pixelflut_pool_attempt_start (pool, connectable, pool->host);
+  g_object_unref (connectable);
+}
+
+static gboolean
+gst_pixelflut_pool_retry (gpointer data)
+{
+  GstPixelflutPool *pool = data;
+
+  GST_OBJECT_LOCK (pool);
+  g_source_unref (pool->retry_source);
+  pool->retry_source = NULL;
+  if (pool->running && g_queue_get_length (&pool->ready) +
+      g_list_length (pool->attempts) < gst_pixelflut_pool_needed_locked (pool)) {
+    gst_pixelflut_pool_attempt_start_host (pool);
+  }
+  GST_OBJECT_UNLOCK (pool);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Start connecting until enough connections are ready or on their way.
+ * While connects are failing only one attempt per backoff period is
+ * made. Called with the object lock held, in the pool thread. */
+static void
+gst_pixelflut_pool_replenish_locked (GstPixelflutPool *pool)
+{
+  if (!pool->running || !pool->connected || pool->retry_source)
+    return;
+
+  while (g_queue_get_length (&pool->ready) + g_list_length (pool->attempts) <
+      gst_pixelflut_pool_needed_locked (pool)) {
+    if (pool->backoff) {
+      pool->retry_source = g_timeout_source_new (pool->backoff / G_TIME_SPAN_MILLISECOND);
+      g_source_set_callback (pool->retry_source, gst_pixelflut_pool_retry, pool, NULL);
+      g_source_attach (pool->retry_source, pool->context);
+      return;
+    }
+    gst_pixelflut_pool_attempt_start_host (pool);
+  }
+}
+
+static gboolean
+gst_pixelflut_pool_kick (gpointer data)
+{
+  GstPixelflutPool *pool = data;
+
+  GST_OBJECT_LOCK (pool);
+  gst_pixelflut_pool_replenish_locked (pool);
+  GST_OBJECT_UNLOCK (pool);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+gst_pixelflut_pool_resolved (GObject *source, GAsyncResult *res, gpointer data)
+{
+  GstPixelflutPool *pool = data;
+  GList *addresses, *l;
+  GError *err = NULL;
+
+  addresses = g_resolver_lookup_by_name_finish (G_RESOLVER (source), res, &err);
+
+  GST_OBJECT_LOCK (pool);
+  pool->resolving = FALSE;
+
+  if (!addresses) {
+    GST_INFO_OBJECT (pool, "resolving %s failed: %s", pool->host, err->message);
+    if (!pool->error)
+      pool->error = err;
+    else
+      g_clear_error (&err);
+    g_cond_broadcast (&pool->cond);
+  } else if (pool->running) {
+    /* race all addresses, the first one to answer SIZE wins and the
+     * others become standby connections */
+    for (l = addresses; l; l = l->next) {
+      GSocketAddress *address = g_inet_socket_address_new (l->data, pool->port);
+      gchar *name = g_inet_address_to_string (l->data);
+
+      gst_pixelflut_pool_attempt_start (pool, G_SOCKET_CONNECTABLE (address), name);
+      g_object_unref (address);
+      g_free (name);
+    }
+  }
+  g_resolver_free_addresses (addresses);
+
+  gst_pixelflut_pool_maybe_quit_locked (pool);
+  GST_OBJECT_UNLOCK (pool);
+
+  gst_object_unref (pool);
+}
+
+static gboolean
+gst_pixelflut_pool_open (gpointer data)
+{
+  GstPixelflutPool *pool = data;
+  GResolver *resolver;
+
+  GST_DEBUG_OBJECT (pool, "resolving %s", pool->host);
+
+  GST_OBJECT_LOCK (pool);
+  pool->resolving = TRUE;
+  GST_OBJECT_UNLOCK (pool);
+
+  resolver = g_resolver_get_default ();
+  g_resolver_lookup_by_name_async (resolver, pool->host, pool->cancellable,
+      gst_pixelflut_pool_resolved, gst_object_ref (pool));
+  g_object_unref (resolver);
+
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean
+gst_pixelflut_pool_shutdown (gpointer data)
+{
+  GstPixelflutPool *pool = data;
+  GList *l;
+
+  g_cancellable_cancel (pool->cancellable);
+
+  GST_OBJECT_LOCK (pool);
+  for (l = pool->attempts; l; l = l->next) {
+    GstPixelflutAttempt *attempt = l->data;
+    g_cancellable_cancel (attempt->cancellable);
+  }
+  if (pool->retry_source) {
+    g_source_destroy (pool->retry_source);
+    g_source_unref (pool->retry_source);
+    pool->retry_source = NULL;
+  }
+  gst_pixelflut_pool_maybe_quit_locked (pool);
+  GST_OBJECT_UNLOCK (pool);
+
+  return G_SOURCE_REMOVE;
+}
+
+static gpointer
+gst_pixelflut_pool_loop (gpointer data)
+{
+  GstPixelflutPool *pool = data;
+
+  g_main_context_push_thread_default (pool->context);
+  g_main_loop_run (pool->loop);
+  g_main_context_pop_thread_default (pool->context);
+
+  return NULL;
+}
+
+/**
+ * gst_pixelflut_pool_start:
+ *
+ * Starts connecting in the background and keeps @n_standby connections
+ * ready afterwards. Each attempt is aborted after @connect_timeout.
+ */
+gboolean
+gst_pixelflut_pool_start (GstPixelflutPool *pool, guint n_standby,
+    GstClockTime connect_timeout)
+{
+  GError *err = NULL;
+
+  GST_OBJECT_LOCK (pool);
+  pool->users++;
+  pool->n_standby = MAX (pool->n_standby, n_standby);
+  if (pool->running) {
+    GST_OBJECT_UNLOCK (pool);
+    return TRUE;
+  }
+  pool->n_standby = n_standby;
+  pool->connect_timeout = connect_timeout;
+  pool->running = TRUE;
+  pool->connected = FALSE;
+  pool->primed = FALSE;
+  pool->backoff = 0;
+  g_clear_error (&pool->error);
+  g_clear_object (&pool->server_address);
+  GST_OBJECT_UNLOCK (pool);
+
+  g_cancellable_reset (pool->cancellable);
+  pool->context = g_main_context_new ();
+  pool->loop = g_main_loop_new (pool->context, FALSE);
+
+  pool->thread = g_thread_try_new ("pixelflutpool", gst_pixelflut_pool_loop, pool, &err);
+  if (!pool->thread) {
+    GST_ERROR_OBJECT (pool, "Failed to start connecting thread: %s", err->message);
+    g_clear_error (&err);
+    GST_OBJECT_LOCK (pool);
+    pool->running = FALSE;
+    pool->users--;
+    GST_OBJECT_UNLOCK (pool);
+    g_clear_pointer (&pool->loop, g_main_loop_unref);
+    g_clear_pointer (&pool->context, g_main_context_unref);
+    return FALSE;
+  }
+
+  g_main_context_invoke_full (pool->context, G_PRIORITY_DEFAULT,
+      gst_pixelflut_pool_open, gst_object_ref (pool), gst_object_unref);
+
+  return TRUE;
+}
+
+/**
+ * gst_pixelflut_pool_stop:
+ *
+ * Closes all connections once the last user of the pool stopped.
+ */
+void
+gst_pixelflut_pool_stop (GstPixelflutPool *pool)
+{
+  GstPixelflutConnection *conn;
+
+  GST_OBJECT_LOCK (pool);
+  if (pool->users > 1) {
+    pool->users--;
+    GST_OBJECT_UNLOCK (pool);
+    return;
+  }
+  pool->users = 0;
+  pool->running = FALSE;
+  conn = pool->shared;
+  pool->shared = NULL;
+  g_cond_broadcast (&pool->cond);
+  GST_OBJECT_UNLOCK (pool);
+
+  gst_pixelflut_connection_free (conn);
+
+  if (pool->thread) {
+    g_main_context_invoke_full (pool->context, G_PRIORITY_HIGH,
+        gst_pixelflut_pool_shutdown, gst_object_ref (pool), gst_object_unref);
+    g_thread_join (pool->thread);
+    pool->thread = NULL;
+  }
+  g_clear_pointer (&pool->loop, g_main_loop_unref);
+  g_clear_pointer (&pool->context, g_main_context_unref);
+
+  while ((conn = g_queue_pop_head (&pool->ready)))
+    gst_pixelflut_connection_free (conn);
+}
+
+static void
+gst_pixelflut_pool_wakeup (GCancellable *cancellable, GstPixelflutPool *pool)
+{
+  GST_OBJECT_LOCK (pool);
+  g_cond_broadcast (&pool->cond);
+  GST_OBJECT_UNLOCK (pool);
+}
+
+/**
+ * gst_pixelflut_pool_take:
+ *
+ * Takes a ready connection out of the pool, waiting at most @timeout for
+ * one to become available. The pool starts replacing it right away.
+ *
+ * Returns: a connection or %NULL with @err set
+ */
+GstPixelflutConnection *
+gst_pixelflut_pool_take (GstPixelflutPool *pool, GstClockTime timeout,
+    GCancellable *cancellable, GError **err)
+{
+  GstPixelflutConnection *conn;
+  gint64 end_time = 0;
+  gulong handler = 0;
+
+  if (GST_CLOCK_TIME_IS_VALID (timeout))
+    end_time = g_get_monotonic_time () + timeout / GST_USECOND;
+
+  if (cancellable)
+    handler = g_cancellable_connect (cancellable,
+        G_CALLBACK (gst_pixelflut_pool_wakeup), pool, NULL);
+
+  GST_OBJECT_LOCK (pool);
+  pool->waiters++;
+  if (pool->context && g_queue_is_empty (&pool->ready))
+    g_main_context_invoke_full (pool->context, G_PRIORITY_DEFAULT,
+        gst_pixelflut_pool_kick, gst_object_ref (pool), gst_object_unref);
+
+  while (!(conn = g_queue_pop_head (&pool->ready))) {
+    if (pool->error) {
+      g_propagate_error (err, g_error_copy (pool->error));
+      break;
+    }
+    if (!pool->running) {
+      g_set_error (err, G_IO_ERROR, G_IO_ERROR_CLOSED, "Connection pool stopped");
+      break;
+    }
+    if (g_cancellable_is_cancelled (cancellable)) {
+      g_set_error (err, G_IO_ERROR, G_IO_ERROR_CANCELLED, "Cancelled");
+      break;
+    }
+    if (!end_time) {
+      g_cond_wait (&pool->cond, GST_OBJECT_GET_LOCK (pool));
+    } else if (!g_cond_wait_until (&pool->cond, GST_OBJECT_GET_LOCK (pool), end_time)) {
+      if ((conn = g_queue_pop_head (&pool->ready)))
+        break;
+      g_set_error (err, G_IO_ERROR, G_IO_ERROR_TIMED_OUT,
+          "Timed out waiting for a connection to %s:%d", pool->host, pool->port);
+      break;
+    }
+  }
+  pool->waiters--;
+  if (conn)
+    pool->primed = TRUE;
+
+  /* let the pool thread replace it */
+  if (conn && pool->context)
+    g_main_context_invoke_full (pool->context, G_PRIORITY_DEFAULT,
+        gst_pixelflut_pool_kick, gst_object_ref (pool), gst_object_unref);
+  GST_OBJECT_UNLOCK (pool);
+
+  if (handler)
+    g_cancellable_disconnect (cancellable, handler);
+
+  return conn;
+}
+
+/**
+ * gst_pixelflut_pool_lease:
+ *
+ * Waits for the turn of the caller and hands out the connection shared
+ * by all lessees of the pool, taking a new one from the pool if there is
+ * none yet, waiting at most @timeout for that. Lessees are served in the
+ * order they asked, so their batches are interleaved fairly. The
+ * connection has to be given back with gst_pixelflut_pool_release().
+ *
+ * Returns: the shared connection or %NULL with @err set
+ */
+GstPixelflutConnection *
+gst_pixelflut_pool_lease (GstPixelflutPool *pool, GstClockTime timeout,
+    GCancellable *cancellable, GError **err)
+{
+  GstPixelflutConnection *conn;
+  GList link = { NULL, };
+  gulong handler = 0;
+
+  if (cancellable)
+    handler = g_cancellable_connect (cancellable,
+        G_CALLBACK (gst_pixelflut_pool_wakeup), pool, NULL);
+
+  GST_OBJECT_LOCK (pool);
+  g_queue_push_tail_link (&pool->lessees, &link);
+  while (pool->leased || pool->lessees.head != &link) {
+    if (!pool->running || g_cancellable_is_cancelled (cancellable))
+      break;
+    g_cond_wait (&pool->cond, GST_OBJECT_GET_LOCK (pool));
+  }
+  g_queue_unlink (&pool->lessees, &link);
+
+  if (!pool->running) {
+    g_set_error (err, G_IO_ERROR, G_IO_ERROR_CLOSED, "Connection pool stopped");
+    goto failed;
+  }
+  if (g_cancellable_set_error_if_cancelled (cancellable, err))
+    goto failed;
+
+  pool->leased = TRUE;
+  conn = pool->shared;
+  GST_OBJECT_UNLOCK (pool);
+
+  /* nobody else touches the shared connection during our turn */
+  if (!conn) {
+    conn = gst_pixelflut_pool_take (pool, timeout, cancellable, err);
+    GST_OBJECT_LOCK (pool);
+    pool->shared = conn;
+    if (!conn) {
+      pool->leased = FALSE;
+      g_cond_broadcast (&pool->cond);
+    }
+    GST_OBJECT_UNLOCK (pool);
+  }
+
+  if (handler)
+    g_cancellable_disconnect (cancellable, handler);
+
+  return conn;
+
+failed:
+  /* the next in line might be waiting for us to go */
+  g_cond_broadcast (&pool->cond);
+  GST_OBJECT_UNLOCK (pool);
+  if (handler)
+    g_cancellable_disconnect (cancellable, handler);
+  return NULL;
+}
+
+/**
+ * gst_pixelflut_pool_release:
+ *
+ * Gives the shared connection back to the next lessee in line. A
+ * @broken connection is closed and replaced on the next lease.
+ */
+void
+gst_pixelflut_pool_release (GstPixelflutPool *pool, GstPixelflutConnection *conn,
+    gboolean broken)
+{
+  GST_OBJECT_LOCK (pool);
+  g_warn_if_fail (pool->leased);
+  if (broken && pool->shared == conn)
+    pool->shared = NULL;
+  else
+    broken = FALSE;
+  pool->leased = FALSE;
+  g_cond_broadcast (&pool->cond);
+  GST_OBJECT_UNLOCK (pool);
+
+  if (broken)
+    gst_pixelflut_connection_free (conn);
+}
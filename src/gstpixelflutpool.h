@@ -0,0 +1,118 @@
+/*
+ * GStreamer Pixelflut
+ * Copyright 2018 Andreas Frisch <fraxinas@schaffenburg.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __GST_PIXELFLUT_POOL_H__
+#define __GST_PIXELFLUT_POOL_H__
+
+#include <gst/gst.h>
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+#define GST_TYPE_PIXELFLUT_POOL gst_pixelflut_pool_get_type ()
+G_DECLARE_FINAL_TYPE (GstPixelflutPool, gst_pixelflut_pool, GST, PIXELFLUT_POOL, GstObject)
+
+/**
+ * GstPixelflutConnection:
+ *
+ * A connected socket to a Pixelflut server which has answered SIZE.
+ */
+typedef struct
+{
+  GSocketConnection *connection;
+  GOutputStream *ostream;
+} GstPixelflutConnection;
+
+/**
+ * GstPixelflutPool:
+ *
+ * Connections to one Pixelflut server. All connecting happens
+ * asynchronously in a thread of the pool: the initial connect tries all
+ * resolved addresses in parallel, afterwards a number of warm standby
+ * connections is kept ready and replenished with exponential backoff.
+ *
+ * A pool can be shared by several sinks, which then take turns sending
+ * their batches over a single connection, see gst_pixelflut_pool_lease().
+ */
+struct _GstPixelflutPool
+{
+  GstObject parent;
+
+  /* server information */
+  gchar *host;
+  gint port;
+  guint canvas_width;
+  guint canvas_height;
+  GstClockTime connect_timeout;
+  /* local addresses to connect from and the server address the first
+   * connection reached, which the bound connections all go to */
+  GPtrArray *bind_addresses;
+  GSocketAddress *server_address;
+
+  /* protected by the object lock */
+  guint n_standby;
+  GQueue ready;
+  GList *attempts;
+  guint waiters;
+  gboolean primed;
+  gboolean connected;
+  GError *error;
+  gint64 backoff;
+  GSource *retry_source;
+  gboolean resolving;
+  gboolean running;
+  guint users;
+  GCond cond;
+
+  /* the connection shared by the lessees, who wait in line for it */
+  GstPixelflutConnection *shared;
+  gboolean leased;
+  GQueue lessees;
+
+  /* connecting thread */
+  GCancellable *cancellable;
+  GMainContext *context;
+  GMainLoop *loop;
+  GThread *thread;
+};
+
+GstPixelflutPool *gst_pixelflut_pool_new (const gchar *host, gint port);
+GstPixelflutPool *gst_pixelflut_pool_get_shared (const gchar *host, gint port);
+
+gboolean gst_pixelflut_pool_set_bind_addresses (GstPixelflutPool *pool,
+    const gchar *addresses, GError **err);
+
+gboolean gst_pixelflut_pool_start (GstPixelflutPool *pool, guint n_standby,
+    GstClockTime connect_timeout);
+void gst_pixelflut_pool_stop (GstPixelflutPool *pool);
+
+GstPixelflutConnection *gst_pixelflut_pool_take (GstPixelflutPool *pool,
+    GstClockTime timeout, GCancellable *cancellable, GError **err);
+
+GstPixelflutConnection *gst_pixelflut_pool_lease (GstPixelflutPool *pool,
+    GstClockTime timeout, GCancellable *cancellable, GError **err);
+void gst_pixelflut_pool_release (GstPixelflutPool *pool,
+    GstPixelflutConnection *conn, gboolean broken);
+
+void gst_pixelflut_connection_free (GstPixelflutConnection *conn);
+
+G_END_DECLS
+
+#endif /* __GST_PIXELFLUT_POOL_H__ */
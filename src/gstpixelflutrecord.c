@@ -0,0 +1,276 @@
+/*
+ * GStreamer Pixelflut
+ * Copyright 2018 Andreas Frisch <fraxinas@schaffenburg.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+
+#include "gstpixelflutrecord.h"
+
+struct _GstPixelflutRecorder
+{
+  FILE *file;
+  gchar *location;
+  guint64 pos;
+  GArray *index;
+  GstPixelflutRecordIndex frame;
+  gboolean in_frame;
+  guint canvas_width;
+  guint canvas_height;
+};
+
+static gboolean
+gst_pixelflut_recorder_fwrite (GstPixelflutRecorder *rec, gconstpointer data,
+    gsize len, GError **err)
+{
+  if (fwrite (data, 1, len, rec->file) != len) {
+    gint errsv = errno;
+    g_set_error (err, G_IO_ERROR, g_io_error_from_errno (errsv),
+        "Could not write to %s: %s", rec->location, g_strerror (errsv));
+    return FALSE;
+  }
+  rec->pos += len;
+
+  return TRUE;
+}
+
+static gboolean
+gst_pixelflut_recorder_write_header (GstPixelflutRecorder *rec, GError **err)
+{
+  GstPixelflutRecordHeader header;
+
+  memset (&header, 0, sizeof (header));
+  memcpy (header.magic, GST_PIXELFLUT_RECORD_MAGIC, sizeof (GST_PIXELFLUT_RECORD_MAGIC));
+  header.version = GUINT32_TO_LE (GST_PIXELFLUT_RECORD_VERSION);
+  header.canvas_width = GUINT32_TO_LE (rec->canvas_width);
+  header.canvas_height = GUINT32_TO_LE (rec->canvas_height);
+
+  return gst_pixelflut_recorder_fwrite (rec, &header, sizeof (header), err);
+}
+
+GstPixelflutRecorder *
+gst_pixelflut_recorder_new (const gchar *location, GError **err)
+{
+  GstPixelflutRecorder *rec;
+  FILE *file;
+
+  file = g_fopen (location, "wb");
+  if (!file) {
+    gint errsv = errno;
+    g_set_error (err, G_IO_ERROR, g_io_error_from_errno (errsv),
+        "Could not open %s for writing: %s", location, g_strerror (errsv));
+    return NULL;
+  }
+
+  rec = g_new0 (GstPixelflutRecorder, 1);
+  rec->file = file;
+  rec->location = g_strdup (location);
+  rec->pos = 0;
+  rec->index = g_array_new (FALSE, FALSE, sizeof (GstPixelflutRecordIndex));
+  rec->in_frame = FALSE;
+
+  /* the canvas size is filled in on close */
+  if (!gst_pixelflut_recorder_write_header (rec, err)) {
+    fclose (rec->file);
+    rec->file = NULL;
+    gst_pixelflut_recorder_close (rec, NULL);
+    return NULL;
+  }
+
+  return rec;
+}
+
+/* Starts a new frame, an unfinished previous one is left out of the index */
+void
+gst_pixelflut_recorder_begin_frame (GstPixelflutRecorder *rec,
+    GstClockTime timestamp, GstClockTime duration, gint offset_left,
+    gint offset_top, guint canvas_width, guint canvas_height)
+{
+  rec->frame.offset = rec->pos;
+  rec->frame.size = 0;
+  rec->frame.timestamp = timestamp;
+  rec->frame.duration = duration;
+  rec->frame.offset_left = offset_left;
+  rec->frame.offset_top = offset_top;
+  rec->in_frame = TRUE;
+
+  rec->canvas_width = MAX (rec->canvas_width, canvas_width);
+  rec->canvas_height = MAX (rec->canvas_height, canvas_height);
+}
+
+gboolean
+gst_pixelflut_recorder_write (GstPixelflutRecorder *rec, const gchar *data,
+    gsize len, GError **err)
+{
+  g_return_val_if_fail (rec->in_frame, FALSE);
+
+  return gst_pixelflut_recorder_fwrite (rec, data, len, err);
+}
+
+void
+gst_pixelflut_recorder_end_frame (GstPixelflutRecorder *rec)
+{
+  if (!rec->in_frame)
+    return;
+
+  rec->frame.size = rec->pos - rec->frame.offset;
+  g_array_append_val (rec->index, rec->frame);
+  rec->in_frame = FALSE;
+}
+
+/* Writes the index and frees the recorder */
+gboolean
+gst_pixelflut_recorder_close (GstPixelflutRecorder *rec, GError **err)
+{
+  GstPixelflutRecordTrailer trailer;
+  static const gchar padding[8] = { 0, };
+  guint64 index_offset;
+  guint i;
+  gboolean ret = FALSE;
+
+  if (!rec->file)
+    goto done;
+
+  index_offset = GST_ROUND_UP_8 (rec->pos);
+  if (!gst_pixelflut_recorder_fwrite (rec, padding, index_offset - rec->pos, err))
+    goto done;
+
+  for (i = 0; i < rec->index->len; i++) {
+    GstPixelflutRecordIndex entry = g_array_index (rec->index, GstPixelflutRecordIndex, i);
+
+    entry.offset = GUINT64_TO_LE (entry.offset);
+    entry.size = GUINT64_TO_LE (entry.size);
+    entry.timestamp = GUINT64_TO_LE (entry.timestamp);
+    entry.duration = GUINT64_TO_LE (entry.duration);
+    entry.offset_left = GINT32_TO_LE (entry.offset_left);
+    entry.offset_top = GINT32_TO_LE (entry.offset_top);
+    if (!gst_pixelflut_recorder_fwrite (rec, &entry, sizeof (entry), err))
+      goto done;
+  }
+
+  trailer.index_offset = GUINT64_TO_LE (index_offset);
+  trailer.n_frames = GUINT64_TO_LE (rec->index->len);
+  memcpy (trailer.magic, GST_PIXELFLUT_RECORD_MAGIC, sizeof (GST_PIXELFLUT_RECORD_MAGIC));
+  if (!gst_pixelflut_recorder_fwrite (rec, &trailer, sizeof (trailer), err))
+    goto done;
+
+  /* now that the canvas size is known */
+  if (fseek (rec->file, 0, SEEK_SET) != 0 ||
+      !gst_pixelflut_recorder_write_header (rec, err))
+    goto done;
+
+  ret = TRUE;
+
+done:
+  if (rec->file && fclose (rec->file) != 0 && ret) {
+    gint errsv = errno;
+    g_set_error (err, G_IO_ERROR, g_io_error_from_errno (errsv),
+        "Could not close %s: %s", rec->location, g_strerror (errsv));
+    ret = FALSE;
+  }
+  g_array_free (rec->index, TRUE);
+  g_free (rec->location);
+  g_free (rec);
+
+  return ret;
+}
+
+GstPixelflutRecording *
+gst_pixelflut_recording_open (const gchar *location, GError **err)
+{
+  GstPixelflutRecording *recording;
+  const GstPixelflutRecordHeader *header;
+  const GstPixelflutRecordTrailer *trailer;
+  GMappedFile *file;
+  const gchar *data;
+  gsize size;
+  guint64 index_offset, n_frames, i;
+
+  file = g_mapped_file_new (location, FALSE, err);
+  if (!file)
+    return NULL;
+
+  data = g_mapped_file_get_contents (file);
+  size = g_mapped_file_get_length (file);
+
+  if (size < sizeof (*header) + sizeof (*trailer))
+    goto invalid;
+
+  header = (const GstPixelflutRecordHeader *) data;
+  trailer = (const GstPixelflutRecordTrailer *) (data + size - sizeof (*trailer));
+  if (memcmp (header->magic, GST_PIXELFLUT_RECORD_MAGIC, sizeof (GST_PIXELFLUT_RECORD_MAGIC)) ||
+      memcmp (trailer->magic, GST_PIXELFLUT_RECORD_MAGIC, sizeof (GST_PIXELFLUT_RECORD_MAGIC)) ||
+      GUINT32_FROM_LE (header->version) != GST_PIXELFLUT_RECORD_VERSION)
+    goto invalid;
+
+  index_offset = GUINT64_FROM_LE (trailer->index_offset);
+  n_frames = GUINT64_FROM_LE (trailer->n_frames);
+  if (index_offset % 8 || index_offset > size - sizeof (*trailer) ||
+      n_frames > (size - sizeof (*trailer) - index_offset) / sizeof (GstPixelflutRecordIndex))
+    goto invalid;
+
+  recording = g_new0 (GstPixelflutRecording, 1);
+  recording->file = file;
+  recording->data = data;
+  recording->canvas_width = GUINT32_FROM_LE (header->canvas_width);
+  recording->canvas_height = GUINT32_FROM_LE (header->canvas_height);
+  recording->index = (const GstPixelflutRecordIndex *) (data + index_offset);
+  recording->n_frames = n_frames;
+
+  /* so that frames can be sent without checking each of them */
+  for (i = 0; i < n_frames; i++) {
+    guint64 offset = GUINT64_FROM_LE (recording->index[i].offset);
+    guint64 len = GUINT64_FROM_LE (recording->index[i].size);
+
+    if (offset > index_offset || len > index_offset - offset) {
+      gst_pixelflut_recording_free (recording);
+      file = NULL;
+      goto invalid;
+    }
+  }
+
+  return recording;
+
+invalid:
+  {
+    g_set_error (err, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+        "%s is not a complete Pixelflut recording", location);
+    if (file)
+      g_mapped_file_unref (file);
+    return NULL;
+  }
+}
+
+void
+gst_pixelflut_recording_free (GstPixelflutRecording *recording)
+{
+  if (!recording)
+    return;
+
+  g_mapped_file_unref (recording->file);
+  g_free (recording);
+}
@@ -0,0 +1,106 @@
+/*
+ * GStreamer Pixelflut
+ * Copyright 2018 Andreas Frisch <fraxinas@schaffenburg.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __GST_PIXELFLUT_RECORD_H__
+#define __GST_PIXELFLUT_RECORD_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Recording file format, all numbers little endian:
+ *
+ *   header    GstPixelflutRecordHeader
+ *   commands  the command stream of all frames, back to back
+ *   index     GstPixelflutRecordIndex per frame, 8 byte aligned
+ *   trailer   GstPixelflutRecordTrailer
+ *
+ * The index is written last, so a recording is only complete once the
+ * recording element was stopped.
+ */
+#define GST_PIXELFLUT_RECORD_MAGIC "PXFLREC"
+#define GST_PIXELFLUT_RECORD_VERSION 1
+#define GST_PIXELFLUT_RECORD_CAPS "application/x-pixelflut"
+
+typedef struct
+{
+  gchar magic[8];
+  guint32 version;
+  guint32 canvas_width;
+  guint32 canvas_height;
+  guint32 reserved;
+} GstPixelflutRecordHeader;
+
+typedef struct
+{
+  guint64 offset;      /* of the frame's commands in the file */
+  guint64 size;
+  guint64 timestamp;   /* running time of the frame, G_MAXUINT64 if unknown */
+  guint64 duration;
+  gint32 offset_left;
+  gint32 offset_top;
+} GstPixelflutRecordIndex;
+
+typedef struct
+{
+  guint64 index_offset;
+  guint64 n_frames;
+  gchar magic[8];
+} GstPixelflutRecordTrailer;
+
+/**
+ * GstPixelflutRecorder:
+ *
+ * Writes the commands sent to the server to a recording file.
+ */
+typedef struct _GstPixelflutRecorder GstPixelflutRecorder;
+
+GstPixelflutRecorder *gst_pixelflut_recorder_new (const gchar *location, GError **err);
+void gst_pixelflut_recorder_begin_frame (GstPixelflutRecorder *rec,
+    GstClockTime timestamp, GstClockTime duration, gint offset_left,
+    gint offset_top, guint canvas_width, guint canvas_height);
+gboolean gst_pixelflut_recorder_write (GstPixelflutRecorder *rec,
+    const gchar *data, gsize len, GError **err);
+void gst_pixelflut_recorder_end_frame (GstPixelflutRecorder *rec);
+gboolean gst_pixelflut_recorder_close (GstPixelflutRecorder *rec, GError **err);
+
+/**
+ * GstPixelflutRecording:
+ *
+ * A recording file mapped into memory for replaying.
+ */
+typedef struct
+{
+  GMappedFile *file;
+  const gchar *data;
+  guint canvas_width;
+  guint canvas_height;
+  const GstPixelflutRecordIndex *index;
+  guint64 n_frames;
+} GstPixelflutRecording;
+
+GstPixelflutRecording *gst_pixelflut_recording_open (const gchar *location,
+    GError **err);
+void gst_pixelflut_recording_free (GstPixelflutRecording *recording);
+
+G_END_DECLS
+
+#endif /* __GST_PIXELFLUT_RECORD_H__ */
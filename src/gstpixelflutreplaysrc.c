@@ -0,0 +1,288 @@
+/*
+ * GStreamer Pixelflut
+ * Copyright 2018 Andreas Frisch <fraxinas@schaffenburg.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/**
+ * SECTION:element-pixelflutreplaysrc
+ * @short_description: Replays recorded Pixelflut command streams.
+ *
+ * Plays back a recording made with the record-location property of
+ * pixelflutsink. The recorded commands are passed on without copying
+ * straight from the memory-mapped file, timestamped as they were
+ * recorded.
+ *
+ * <refsect2>
+ * <title>Example launch line</title>
+ * |[
+ * gst-launch-1.0 pixelflutreplaysrc location=show.pxfl ! pixelflutsink host=127.0.0.1
+ * ]| This sends the recorded frames at their original pace, with sync=false
+ * on the sink they are sent as fast as the connection allows
+ * </refsect2>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "gstpixelflutreplaysrc.h"
+
+GST_DEBUG_CATEGORY_STATIC (pixelflutreplaysrc_debug);
+#define GST_CAT_DEFAULT pixelflutreplaysrc_debug
+
+G_DEFINE_TYPE (GstPixelflutReplaySrc, gst_pixelflutreplaysrc, GST_TYPE_PUSH_SRC);
+
+enum
+{
+  PROP_0,
+  PROP_LOCATION,
+  PROP_LOOP,
+};
+
+#define DEFAULT_LOOP FALSE
+
+static GstStaticPadTemplate gst_pixelflut_replay_src_template =
+GST_STATIC_PAD_TEMPLATE ("src",
+    GST_PAD_SRC,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS (GST_PIXELFLUT_RECORD_CAPS)
+    );
+
+static void gst_pixelflutreplaysrc_set_property (GObject *object, guint prop_id,
+    const GValue *value, GParamSpec *pspec);
+static void gst_pixelflutreplaysrc_get_property (GObject *object, guint prop_id,
+    GValue *value, GParamSpec *pspec);
+static void gst_pixelflutreplaysrc_finalize (GObject *object);
+static gboolean gst_pixelflutreplaysrc_start (GstBaseSrc *bsrc);
+static gboolean gst_pixelflutreplaysrc_stop (GstBaseSrc *bsrc);
+static GstFlowReturn gst_pixelflutreplaysrc_create (GstPushSrc *psrc, GstBuffer **outbuf);
+
+static void
+gst_pixelflutreplaysrc_class_init (GstPixelflutReplaySrcClass *klass)
+{
+  GObjectClass *gobject_class = (GObjectClass *) klass;
+  GstElementClass *element_class = (GstElementClass *) klass;
+  GstBaseSrcClass *gstbasesrc_class = (GstBaseSrcClass *) klass;
+  GstPushSrcClass *gstpushsrc_class = (GstPushSrcClass *) klass;
+
+  GST_DEBUG_CATEGORY_INIT (pixelflutreplaysrc_debug, "pixelflutreplaysrc", 0, "pixelflutreplaysrc");
+
+  gobject_class->set_property = gst_pixelflutreplaysrc_set_property;
+  gobject_class->get_property = gst_pixelflutreplaysrc_get_property;
+  gobject_class->finalize     = gst_pixelflutreplaysrc_finalize;
+
+  g_object_class_install_property (gobject_class, PROP_LOCATION,
+      g_param_spec_string ("location", "Location", "Recording to play back",
+          NULL, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_READY));
+  g_object_class_install_property (gobject_class, PROP_LOOP,
+      g_param_spec_boolean ("loop", "Loop", "Start over at the end of the recording",
+          DEFAULT_LOOP, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_PLAYING));
+
+  gst_element_class_set_static_metadata (element_class,
+      "Pixelflut Replay Source", "Source/Network",
+      "Plays back recorded Pixelflut command streams", "Andreas Frisch <fraxinas@schaffenburg.org>");
+
+  gst_element_class_add_pad_template (element_class,
+      gst_static_pad_template_get (&gst_pixelflut_replay_src_template));
+
+  gstbasesrc_class->start = GST_DEBUG_FUNCPTR (gst_pixelflutreplaysrc_start);
+  gstbasesrc_class->stop = GST_DEBUG_FUNCPTR (gst_pixelflutreplaysrc_stop);
+
+  gstpushsrc_class->create = GST_DEBUG_FUNCPTR (gst_pixelflutreplaysrc_create);
+}
+
+static void
+gst_pixelflutreplaysrc_init (GstPixelflutReplaySrc *self)
+{
+  self->location = NULL;
+  self->loop = DEFAULT_LOOP;
+  self->recording = NULL;
+
+  gst_base_src_set_format (GST_BASE_SRC (self), GST_FORMAT_TIME);
+}
+
+static void
+gst_pixelflutreplaysrc_finalize (GObject *object)
+{
+  GstPixelflutReplaySrc *self = GST_PIXELFLUTREPLAYSRC (object);
+
+  g_free (self->location);
+
+  G_OBJECT_CLASS (gst_pixelflutreplaysrc_parent_class)->finalize (object);
+}
+
+static void
+gst_pixelflutreplaysrc_set_property (GObject *object, guint prop_id,
+    const GValue *value, GParamSpec *pspec)
+{
+  GstPixelflutReplaySrc *self = GST_PIXELFLUTREPLAYSRC (object);
+
+  GST_OBJECT_LOCK (self);
+  switch (prop_id) {
+    case PROP_LOCATION:
+      g_free (self->location);
+      self->location = g_value_dup_string (value);
+      break;
+    case PROP_LOOP:
+      self->loop = g_value_get_boolean (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+  GST_OBJECT_UNLOCK (self);
+}
+
+static void
+gst_pixelflutreplaysrc_get_property (GObject *object, guint prop_id,
+    GValue *value, GParamSpec *pspec)
+{
+  GstPixelflutReplaySrc *self = GST_PIXELFLUTREPLAYSRC (object);
+
+  GST_OBJECT_LOCK (self);
+  switch (prop_id) {
+    case PROP_LOCATION:
+      g_value_set_string (value, self->location);
+      break;
+    case PROP_LOOP:
+      g_value_set_boolean (value, self->loop);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+  GST_OBJECT_UNLOCK (self);
+}
+
+static gboolean
+gst_pixelflutreplaysrc_start (GstBaseSrc *bsrc)
+{
+  GstPixelflutReplaySrc *self = GST_PIXELFLUTREPLAYSRC (bsrc);
+  GstPixelflutRecording *recording;
+  GError *err = NULL;
+  gchar *location;
+  guint64 i;
+
+  GST_OBJECT_LOCK (self);
+  location = g_strdup (self->location);
+  GST_OBJECT_UNLOCK (self);
+
+  if (!location)
+    goto no_location;
+
+  recording = gst_pixelflut_recording_open (location, &err);
+  if (!recording)
+    goto open_failed;
+
+  GST_INFO_OBJECT (self, "%" G_GUINT64_FORMAT " frames for a %ux%u canvas in %s",
+      recording->n_frames, recording->canvas_width, recording->canvas_height,
+      location);
+  g_free (location);
+
+  self->recording = recording;
+  self->frame = 0;
+  self->loop_offset = 0;
+  self->last_end = 0;
+
+  /* playback starts at 0 */
+  self->first_timestamp = GST_CLOCK_TIME_NONE;
+  for (i = 0; i < recording->n_frames; i++) {
+    GstClockTime ts = GUINT64_FROM_LE (recording->index[i].timestamp);
+    if (GST_CLOCK_TIME_IS_VALID (ts)) {
+      self->first_timestamp = ts;
+      break;
+    }
+  }
+
+  return TRUE;
+
+  /* ERRORS */
+no_location:
+  {
+    GST_ELEMENT_ERROR (self, RESOURCE, NOT_FOUND, ("No location set"), (NULL));
+    return FALSE;
+  }
+open_failed:
+  {
+    GST_ELEMENT_ERROR (self, RESOURCE, OPEN_READ, ("%s", err->message), (NULL));
+    g_clear_error (&err);
+    g_free (location);
+    return FALSE;
+  }
+}
+
+static gboolean
+gst_pixelflutreplaysrc_stop (GstBaseSrc *bsrc)
+{
+  GstPixelflutReplaySrc *self = GST_PIXELFLUTREPLAYSRC (bsrc);
+
+  gst_pixelflut_recording_free (self->recording);
+  self->recording = NULL;
+
+  return TRUE;
+}
+
+static GstFlowReturn
+gst_pixelflutreplaysrc_create (GstPushSrc *psrc, GstBuffer **outbuf)
+{
+  GstPixelflutReplaySrc *self = GST_PIXELFLUTREPLAYSRC (psrc);
+  GstPixelflutRecording *recording = self->recording;
+  const GstPixelflutRecordIndex *entry;
+  GstBuffer *buffer;
+  GstClockTime timestamp, duration;
+  guint64 offset, size;
+  gboolean loop;
+
+  GST_OBJECT_LOCK (self);
+  loop = self->loop;
+  GST_OBJECT_UNLOCK (self);
+
+  if (self->frame >= recording->n_frames) {
+    if (!loop || recording->n_frames == 0)
+      return GST_FLOW_EOS;
+    GST_DEBUG_OBJECT (self, "starting over");
+    self->frame = 0;
+    self->loop_offset = self->last_end;
+  }
+
+  entry = &recording->index[self->frame++];
+  offset = GUINT64_FROM_LE (entry->offset);
+  size = GUINT64_FROM_LE (entry->size);
+  timestamp = GUINT64_FROM_LE (entry->timestamp);
+  duration = GUINT64_FROM_LE (entry->duration);
+
+  /* the mapping stays alive as long as any of its buffers */
+  buffer = gst_buffer_new_wrapped_full (GST_MEMORY_FLAG_READONLY,
+      (gpointer) recording->data, offset + size, offset, size,
+      g_mapped_file_ref (recording->file), (GDestroyNotify) g_mapped_file_unref);
+
+  if (GST_CLOCK_TIME_IS_VALID (timestamp) && timestamp >= self->first_timestamp) {
+    GST_BUFFER_PTS (buffer) = timestamp - self->first_timestamp + self->loop_offset;
+    GST_BUFFER_DURATION (buffer) = duration;
+    self->last_end = GST_BUFFER_PTS (buffer) +
+        (GST_CLOCK_TIME_IS_VALID (duration) ? duration : 0);
+  }
+
+  GST_LOG_OBJECT (self, "frame %" G_GUINT64_FORMAT ": %" G_GUINT64_FORMAT
+      " bytes at %" GST_TIME_FORMAT, self->frame - 1, size,
+      GST_TIME_ARGS (GST_BUFFER_PTS (buffer)));
+
+  *outbuf = buffer;
+
+  return GST_FLOW_OK;
+}
@@ -0,0 +1,56 @@
+/*
+ * GStreamer Pixelflut
+ * Copyright 2018 Andreas Frisch <fraxinas@schaffenburg.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __GST_PIXELFLUTREPLAYSRC_H__
+#define __GST_PIXELFLUTREPLAYSRC_H__
+
+#include <gst/gst.h>
+#include <gst/base/gstpushsrc.h>
+
+#include "gstpixelflutrecord.h"
+
+G_BEGIN_DECLS
+
+#define GST_TYPE_PIXELFLUTREPLAYSRC gst_pixelflutreplaysrc_get_type ()
+G_DECLARE_FINAL_TYPE (GstPixelflutReplaySrc, gst_pixelflutreplaysrc, GST, PIXELFLUTREPLAYSRC, GstPushSrc)
+
+/**
+ * GstPixelflutReplaySrc:
+ *
+ * Opaque data structure.
+ */
+struct _GstPixelflutReplaySrc
+{
+  GstPushSrc parent;
+
+  gchar *location;
+  gboolean loop;
+
+  GstPixelflutRecording *recording;
+  guint64 frame;
+  /* timestamp of the first frame and where the current loop started */
+  GstClockTime first_timestamp;
+  GstClockTime loop_offset;
+  GstClockTime last_end;
+};
+
+G_END_DECLS
+
+#endif /* __GST_PIXELFLUTREPLAYSRC_H__ */
@@ -39,6 +39,7 @@
 #endif
 
 #include <stdio.h>
+#include <string.h>
 
 #include "gstpixelflutsink.h"
 
@@ -62,22 +63,96 @@ enum
   PROP_CANVAS_WIDTH,
   PROP_CANVAS_HEIGHT,
   PROP_STRATEGY,
+  PROP_PACING,
+  PROP_CUT_OFF,
+  PROP_FRAMES_CUT,
+  PROP_CURRENT_PPP,
+  PROP_STANDBY_CONNECTIONS,
+  PROP_RECONNECTS,
+  PROP_CONNECT_TIMEOUT,
+  PROP_TRANSPORT,
+  PROP_MTU,
+  PROP_DATAGRAMS_SENT,
+  PROP_DATAGRAMS_DROPPED,
+  PROP_IO_URING,
+  PROP_RECORD_LOCATION,
+  PROP_BIND_ADDRESSES,
+  PROP_SHARED_POOL,
+  PROP_SCALE_WIDTH,
+  PROP_SCALE_HEIGHT,
+  PROP_COLOR_LUT,
+  PROP_LATENCY_MARKER,
+  PROP_MARKER_X,
+  PROP_MARKER_Y,
+  PROP_ORDER,
+  PROP_BACKGROUND,
+  PROP_PIXELS_SENT,
 };
 
 #define DEFAULT_PORT 1337
 #define DEFAULT_HOST "localhost"
 #define DEFAULT_PPP 10
+#define PPP_MAX 10000
+/* longest command, "PX -2147483648 -2147483648 rrggbbaa\n" */
+#define PX_MAX_LEN 37
+/* automatic batch sizing, see gst_pixelflutsink_adapt_ppp() */
+#define AUTO_PPP_MIN 8
+#define AUTO_PPP_START 64
+#define AUTO_PPP_TARGET_LATENCY (2 * GST_MSECOND)
 #define DEFAULT_STRATEGY GST_PIXELFLUTSINK_STRATEGY_FULLFRAME
-#define CANVAS_MAX 9999
+#define DEFAULT_ORDER GST_PIXELFLUTSINK_ORDER_RASTER
+/* pixels of a span converted at once */
+#define SPAN_CHUNK 64
+/* the random order is the same for every frame and run */
+#define PERMUTATION_SEED 0x50584658
+/* transparent, pixels no longer covered are left alone */
+#define DEFAULT_BACKGROUND 0
+#define DEFAULT_PACING FALSE
+#define DEFAULT_CUT_OFF FALSE
+#define DEFAULT_LATENCY_MARKER FALSE
+/* the marker color holds the lower 24 bits of the frame counter */
+#define MARKER_COUNT_MASK 0xffffff
+#define DEFAULT_STANDBY_CONNECTIONS 1
+#define STANDBY_MAX 16
+#define DEFAULT_CONNECT_TIMEOUT 5000
+#define DEFAULT_TRANSPORT GST_PIXELFLUTSINK_TRANSPORT_TCP
+#define DEFAULT_MTU 1400
+#define MTU_MIN 64
+#define MTU_MAX 65507
+/* datagrams handed to the kernel per g_socket_send_messages() call */
+#define UDP_BATCH 64
+#define DEFAULT_IO_URING FALSE
+/* packets in flight with io_uring, one more is being filled */
+#define URING_ARENAS 4
+/* coordinates are sent as gint */
+#define CANVAS_MAX G_MAXINT
+/* layers are composited in tiles of TILE_SIZE x TILE_SIZE pixels, of
+ * which what was sent is kept for up to TILES_MAX (64 MiB) */
+#define TILE_SIZE 256
+#define TILES_MAX 256
+#define DEFAULT_SHARED_POOL FALSE
+/* context holding a field "host:port" with the pool for each server */
+#define PIXELFLUT_POOL_CONTEXT_TYPE "gst.pixelflut.pool"
+
+#define PIXELFLUT_VIDEO_FORMATS "{ " \
+    "ARGB, BGRA, ABGR, RGBA, xRGB," \
+    "RGBx, xBGR, BGRx, RGB, BGR, I420, NV12 }"
 
 /* Define a generic SINKPAD template */
 static GstStaticPadTemplate gst_pixelflut_sink_template =
 GST_STATIC_PAD_TEMPLATE ("sink",
     GST_PAD_SINK,
     GST_PAD_ALWAYS,
-    GST_STATIC_CAPS (GST_VIDEO_CAPS_MAKE ("{ "
-            "ARGB, BGRA, ABGR, RGBA, xRGB,"
-            "RGBx, xBGR, BGRx, RGB, BGR }"))
+    GST_STATIC_CAPS (GST_VIDEO_CAPS_MAKE (PIXELFLUT_VIDEO_FORMATS) "; "
+        GST_PIXELFLUT_RECORD_CAPS)
+    );
+
+/* layers on top of the sink pad */
+static GstStaticPadTemplate gst_pixelflut_layer_template =
+GST_STATIC_PAD_TEMPLATE ("layer_%u",
+    GST_PAD_SINK,
+    GST_PAD_REQUEST,
+    GST_STATIC_CAPS (GST_VIDEO_CAPS_MAKE (PIXELFLUT_VIDEO_FORMATS))
     );
 
 static gboolean gst_pixelflutsink_start (GstBaseSink * bsink);
@@ -85,12 +160,18 @@ static gboolean gst_pixelflutsink_stop (GstBaseSink * bsink);
 static gboolean gst_pixelflutsink_setcaps (GstBaseSink * bsink, GstCaps * caps);
 static gboolean gst_pixelflutsink_unlock (GstBaseSink * bsink);
 static gboolean gst_pixelflutsink_unlock_stop (GstBaseSink * bsink);
+static GstFlowReturn gst_pixelflutsink_preroll (GstBaseSink * bsink, GstBuffer * buffer);
+static GstPad *gst_pixelflutsink_request_new_pad (GstElement * element,
+    GstPadTemplate * templ, const gchar * name, const GstCaps * caps);
+static void gst_pixelflutsink_release_pad (GstElement * element, GstPad * pad);
+static void gst_pixelflutsink_set_context (GstElement * element, GstContext * context);
 
 static void gst_pixelflutsink_set_property (GObject *object, guint prop_id, const GValue *value, GParamSpec *pspec);
 static void gst_pixelflutsink_get_property (GObject *object, guint prop_id, GValue *value, GParamSpec *pspec);
 static void gst_pixelflutsink_finalize (GObject *object);
 
 static GstFlowReturn gst_pixelflutsink_send_frame (GstVideoSink * videosink, GstBuffer * buffer);
+static GstPixelflutSinkKernel gst_pixelflutsink_get_kernel (GstVideoFormat format);
 
 #define GST_TYPE_PIXELFLUTSINK_STRATEGY (gst_pixelflutsink_strategy_get_type ())
 static GType
@@ -110,6 +191,44 @@ gst_pixelflutsink_strategy_get_type (void)
   return gst_pixelflutsink_strategy;
 }
 
+#define GST_TYPE_PIXELFLUTSINK_ORDER (gst_pixelflutsink_order_get_type ())
+static GType
+gst_pixelflutsink_order_get_type (void)
+{
+  static GType gst_pixelflutsink_order = 0;
+  static const GEnumValue orders[] = {
+    {GST_PIXELFLUTSINK_ORDER_RASTER, "Row by row from the top", "raster"},
+    {GST_PIXELFLUTSINK_ORDER_INTERLACED, "Every 8th row first, then the rows in between", "interlaced"},
+    {GST_PIXELFLUTSINK_ORDER_PROGRESSIVE, "An 8x8 grid first, then 4x4, 2x2 and 1x1", "progressive"},
+    {GST_PIXELFLUTSINK_ORDER_RANDOM, "A fixed pseudo-random permutation", "random"},
+    {0, NULL, NULL}
+  };
+
+  if (!gst_pixelflutsink_order) {
+    gst_pixelflutsink_order =
+        g_enum_register_static ("GstPixelflutSinkOrder", orders);
+  }
+  return gst_pixelflutsink_order;
+}
+
+#define GST_TYPE_PIXELFLUTSINK_TRANSPORT (gst_pixelflutsink_transport_get_type ())
+static GType
+gst_pixelflutsink_transport_get_type (void)
+{
+  static GType gst_pixelflutsink_transport = 0;
+  static const GEnumValue transports[] = {
+    {GST_PIXELFLUTSINK_TRANSPORT_TCP, "TCP stream", "tcp"},
+    {GST_PIXELFLUTSINK_TRANSPORT_UDP, "UDP datagrams", "udp"},
+    {0, NULL, NULL}
+  };
+
+  if (!gst_pixelflutsink_transport) {
+    gst_pixelflutsink_transport =
+        g_enum_register_static ("GstPixelflutSinkTransport", transports);
+  }
+  return gst_pixelflutsink_transport;
+}
+
 static void
 gst_pixelflutsink_class_init (GstPixelflutSinkClass *klass)
 {
@@ -142,18 +261,42 @@ gst_pixelflutsink_class_init (GstPixelflutSinkClass *klass)
       g_param_spec_int ("offset-left",
           "Offset Left", "Offset in pixel from left side of the canvas", G_MININT, G_MAXINT, 0,
           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_PLAYING));
+  g_object_class_install_property (gobject_class, PROP_SCALE_WIDTH,
+      g_param_spec_uint ("scale-width",
+          "Scale width", "Width to draw the frames at (0 = frame width or keep aspect ratio)",
+          0, CANVAS_MAX, 0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_PLAYING));
+  g_object_class_install_property (gobject_class, PROP_SCALE_HEIGHT,
+      g_param_spec_uint ("scale-height",
+          "Scale height", "Height to draw the frames at (0 = frame height or keep aspect ratio)",
+          0, CANVAS_MAX, 0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_PLAYING));
+  g_object_class_install_property (gobject_class, PROP_COLOR_LUT,
+      g_param_spec_string ("color-lut", "Color LUT",
+          "Color correction to apply, a .cube file or 3x256 values for red, green and blue",
+          NULL, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_READY));
   g_object_class_install_property (gobject_class, PROP_FRAMES_SENT,
-      g_param_spec_int ("frames-sent",
-          "Frames sent", "Number of frames sent", G_MININT, G_MAXINT, 0,
+      g_param_spec_uint64 ("frames-sent",
+          "Frames sent", "Number of frames sent", 0, G_MAXUINT64, 0,
           G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
   g_object_class_install_property (gobject_class, PROP_BYTES_WRITTEN,
-      g_param_spec_int ("bytes-written",
-          "Bytes written", "Number of bytes written", G_MININT, G_MAXINT, 0,
+      g_param_spec_uint64 ("bytes-written",
+          "Bytes written", "Number of bytes written", 0, G_MAXUINT64, 0,
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_PIXELS_SENT,
+      g_param_spec_uint64 ("pixels-sent",
+          "Pixels sent", "Number of pixels drawn from frames", 0, G_MAXUINT64, 0,
           G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
   g_object_class_install_property (gobject_class, PROP_PIXELS_PER_PACKET,
       g_param_spec_uint ("ppp",
-          "Pixels per packet", "How many pixels to transmit at once", 0, 10000, DEFAULT_PPP,
+          "Pixels per packet", "How many pixels to transmit at once (0 = automatic)",
+          0, PPP_MAX, DEFAULT_PPP,
           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_PLAYING));
+  g_object_class_install_property (gobject_class, PROP_CURRENT_PPP,
+      g_param_spec_uint ("current-ppp",
+          "Current pixels per packet", "How many pixels are currently transmitted at once",
+          0, PPP_MAX, DEFAULT_PPP,
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
   g_object_class_install_property (gobject_class, PROP_CANVAS_WIDTH,
       g_param_spec_uint ("canvas-width",
           "Canvas width", "Width of Pixelflut server's canvas in pixels", 0, CANVAS_MAX, 0,
@@ -167,6 +310,97 @@ gst_pixelflutsink_class_init (GstPixelflutSinkClass *klass)
           "Which pixels should be updated per frame, and how.",
           GST_TYPE_PIXELFLUTSINK_STRATEGY, DEFAULT_STRATEGY,
           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_ORDER,
+      g_param_spec_enum ("order", "Order",
+          "In which order the pixels of a frame are sent, so that a frame cut off "
+          "early covers the whole image evenly",
+          GST_TYPE_PIXELFLUTSINK_ORDER, DEFAULT_ORDER,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_PLAYING));
+  g_object_class_install_property (gobject_class, PROP_BACKGROUND,
+      g_param_spec_uint ("background", "Background",
+          "Color as 0xAARRGGBB to draw where the frame no longer covers the "
+          "canvas after it moved, nothing is erased with an alpha of 0",
+          0, G_MAXUINT32, DEFAULT_BACKGROUND,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_PLAYING));
+  g_object_class_install_property (gobject_class, PROP_STANDBY_CONNECTIONS,
+      g_param_spec_uint ("standby-connections",
+          "Standby connections", "How many connections to keep ready for switching over",
+          0, STANDBY_MAX, DEFAULT_STANDBY_CONNECTIONS,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_READY));
+  g_object_class_install_property (gobject_class, PROP_CONNECT_TIMEOUT,
+      g_param_spec_uint ("connect-timeout",
+          "Connect timeout", "Time to connect and receive the canvas size in ms (0 = forever)",
+          0, G_MAXUINT, DEFAULT_CONNECT_TIMEOUT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_READY));
+  g_object_class_install_property (gobject_class, PROP_BIND_ADDRESSES,
+      g_param_spec_string ("bind-addresses", "Bind addresses",
+          "Comma separated local addresses, address ranges or interfaces to connect from",
+          NULL, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_READY));
+  g_object_class_install_property (gobject_class, PROP_SHARED_POOL,
+      g_param_spec_boolean ("shared-pool", "Shared pool",
+          "Share the connection with the other sinks sending to the same server",
+          DEFAULT_SHARED_POOL,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_READY));
+  g_object_class_install_property (gobject_class, PROP_RECONNECTS,
+      g_param_spec_uint64 ("reconnects",
+          "Reconnects", "Number of times a closed connection was replaced", 0, G_MAXUINT64, 0,
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_TRANSPORT,
+      g_param_spec_enum ("transport", "Transport",
+          "How to send the pixels to the server",
+          GST_TYPE_PIXELFLUTSINK_TRANSPORT, DEFAULT_TRANSPORT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_READY));
+  g_object_class_install_property (gobject_class, PROP_MTU,
+      g_param_spec_uint ("mtu",
+          "MTU", "Maximum size of a datagram in bytes (UDP transport)",
+          MTU_MIN, MTU_MAX, DEFAULT_MTU,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_READY));
+  g_object_class_install_property (gobject_class, PROP_DATAGRAMS_SENT,
+      g_param_spec_uint64 ("datagrams-sent",
+          "Datagrams sent", "Number of datagrams sent (UDP transport)", 0, G_MAXUINT64, 0,
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_DATAGRAMS_DROPPED,
+      g_param_spec_uint64 ("datagrams-dropped",
+          "Datagrams dropped", "Number of datagrams the kernel didn't take (UDP transport)",
+          0, G_MAXUINT64, 0,
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_IO_URING,
+      g_param_spec_boolean ("io-uring", "io_uring",
+          "Send with io_uring and zero-copy if available (TCP transport)",
+          DEFAULT_IO_URING,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_READY));
+  g_object_class_install_property (gobject_class, PROP_RECORD_LOCATION,
+      g_param_spec_string ("record-location", "Record location",
+          "File to record the sent commands to for pixelflutreplaysrc",
+          NULL, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_READY));
+  g_object_class_install_property (gobject_class, PROP_PACING,
+      g_param_spec_boolean ("pacing", "Pacing",
+          "Spread the pixels of a frame evenly over the frame duration (requires sync)",
+          DEFAULT_PACING,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_PLAYING));
+  g_object_class_install_property (gobject_class, PROP_CUT_OFF,
+      g_param_spec_boolean ("cut-off", "Cut off",
+          "Stop sending a frame once its duration has elapsed",
+          DEFAULT_CUT_OFF,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_PLAYING));
+  g_object_class_install_property (gobject_class, PROP_FRAMES_CUT,
+      g_param_spec_uint64 ("frames-cut",
+          "Frames cut", "Number of frames cut off at their deadline", 0, G_MAXUINT64, 0,
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_LATENCY_MARKER,
+      g_param_spec_boolean ("latency-marker", "Latency marker",
+          "Draw a marker pixel holding the frame counter last in each frame "
+          "and post a pixelflut-latency-marker message when it was due",
+          DEFAULT_LATENCY_MARKER,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_PLAYING));
+  g_object_class_install_property (gobject_class, PROP_MARKER_X,
+      g_param_spec_uint ("marker-x",
+          "Marker X", "Canvas column of the latency marker", 0, CANVAS_MAX, 0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_PLAYING));
+  g_object_class_install_property (gobject_class, PROP_MARKER_Y,
+      g_param_spec_uint ("marker-y",
+          "Marker Y", "Canvas row of the latency marker", 0, CANVAS_MAX, 0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_PLAYING));
 
   gst_element_class_set_static_metadata (element_class,
       "Pixelflut Sink", "Sink/Video/Network",
@@ -174,6 +408,13 @@ gst_pixelflutsink_class_init (GstPixelflutSinkClass *klass)
 
   gst_element_class_add_pad_template (element_class,
       gst_static_pad_template_get (&gst_pixelflut_sink_template));
+  gst_element_class_add_static_pad_template_with_gtype (element_class,
+      &gst_pixelflut_layer_template, GST_TYPE_PIXELFLUT_LAYER_PAD);
+
+  /* overwrite virtual GstElement functions */
+  element_class->request_new_pad = GST_DEBUG_FUNCPTR (gst_pixelflutsink_request_new_pad);
+  element_class->release_pad = GST_DEBUG_FUNCPTR (gst_pixelflutsink_release_pad);
+  element_class->set_context = GST_DEBUG_FUNCPTR (gst_pixelflutsink_set_context);
 
   /* overwrite virtual GstBaseSink functions */
   gstbasesink_class->start = GST_DEBUG_FUNCPTR (gst_pixelflutsink_start);
@@ -181,6 +422,7 @@ gst_pixelflutsink_class_init (GstPixelflutSinkClass *klass)
   gstbasesink_class->set_caps = GST_DEBUG_FUNCPTR (gst_pixelflutsink_setcaps);
   gstbasesink_class->unlock = GST_DEBUG_FUNCPTR (gst_pixelflutsink_unlock);
   gstbasesink_class->unlock_stop = GST_DEBUG_FUNCPTR (gst_pixelflutsink_unlock_stop);
+  gstbasesink_class->preroll = GST_DEBUG_FUNCPTR (gst_pixelflutsink_preroll);
 
   /* overwrite virtual GstVideoSink functions */
   gstvideosink_class->show_frame = GST_DEBUG_FUNCPTR (gst_pixelflutsink_send_frame);
@@ -191,15 +433,64 @@ gst_pixelflutsink_init (GstPixelflutSink *self)
 {
   self->offset_top = 0;
   self->offset_left = 0;
+  self->scale_width = 0;
+  self->scale_height = 0;
 
   self->host = g_strdup (DEFAULT_HOST);
   self->port = DEFAULT_PORT;
 
   self->cancellable = g_cancellable_new ();
+  self->pool = NULL;
+  self->conn = NULL;
+  self->standby_connections = DEFAULT_STANDBY_CONNECTIONS;
+  self->connect_timeout = DEFAULT_CONNECT_TIMEOUT * GST_MSECOND;
+  self->bind_addresses = NULL;
+  self->shared_pool = DEFAULT_SHARED_POOL;
+  self->pool_context = NULL;
+  self->leasing = FALSE;
+  self->transport = DEFAULT_TRANSPORT;
+  self->mtu = DEFAULT_MTU;
+  self->udp_socket = NULL;
+  self->io_uring = DEFAULT_IO_URING;
+  self->uring = NULL;
+  self->arena = NULL;
 
   self->pixels_per_packet = DEFAULT_PPP;
+  self->current_ppp = DEFAULT_PPP;
+  self->outbuf = NULL;
+  self->outbuf_size = 0;
+  self->kernel = NULL;
   self->strategy = DEFAULT_STRATEGY;
   self->prev_buffer = NULL;
+  self->prev_left = 0;
+  self->prev_top = 0;
+  self->prev_width = 0;
+  self->prev_height = 0;
+  self->background = DEFAULT_BACKGROUND;
+  self->order = DEFAULT_ORDER;
+  self->permutation = NULL;
+  self->permutation_width = 0;
+  self->permutation_height = 0;
+  self->passthrough = FALSE;
+  self->record_location = NULL;
+  self->recorder = NULL;
+  self->color_lut = NULL;
+  self->lut = NULL;
+  self->layers = NULL;
+  self->next_layer = 0;
+  self->composite = NULL;
+  self->tiles = NULL;
+  self->tiles_width = 0;
+  self->tiles_height = 0;
+
+  self->pacing = DEFAULT_PACING;
+  self->cut_off = DEFAULT_CUT_OFF;
+  self->avg_render_time = GST_CLOCK_TIME_NONE;
+
+  self->latency_marker = DEFAULT_LATENCY_MARKER;
+  self->marker_x = 0;
+  self->marker_y = 0;
+  self->marker_count = 0;
 
   self->is_open = FALSE;
 
@@ -211,13 +502,22 @@ static void gst_pixelflutsink_finalize (GObject *object)
   GstPixelflutSink *self = GST_PIXELFLUTSINK (object);
 
   g_clear_object (&self->cancellable);
+  g_clear_pointer (&self->pool_context, gst_context_unref);
 
   g_free (self->host);
+  g_free (self->outbuf);
+  g_free (self->record_location);
+  g_free (self->bind_addresses);
+  g_free (self->color_lut);
+  g_free (self->composite);
+  g_clear_pointer (&self->tiles, g_hash_table_unref);
+  g_free (self->permutation);
+  g_list_free_full (self->layers, gst_object_unref);
 
-  gst_buffer_unref (self->prev_buffer);
+  gst_clear_buffer (&self->prev_buffer);
 
-  GST_INFO_OBJECT (self, "finalized. sent %i frames and %" G_GSIZE_FORMAT
-                   " bytes", self->frames_sent, self->bytes_written);
+  GST_INFO_OBJECT (self, "finalized. sent %" G_GUINT64_FORMAT " frames and %"
+                   G_GUINT64_FORMAT " bytes", self->frames_sent, self->bytes_written);
 
   /* "chain up" to base class method */
   G_OBJECT_CLASS (gst_pixelflutsink_parent_class)->finalize (object);
@@ -231,13 +531,26 @@ gst_pixelflutsink_setcaps (GstBaseSink * basesink, GstCaps * caps)
 
   GST_DEBUG_OBJECT (self, "setcaps %" GST_PTR_FORMAT, caps);
 
+  if (gst_structure_has_name (gst_caps_get_structure (caps, 0),
+          GST_PIXELFLUT_RECORD_CAPS)) {
+    GST_OBJECT_LOCK (self);
+    self->passthrough = TRUE;
+    GST_OBJECT_UNLOCK (self);
+    return TRUE;
+  }
+
   if (!gst_video_info_from_caps (&info, caps))
     goto invalid_caps;
 
   GST_OBJECT_LOCK (self);
   self->info = info;
+  self->kernel = gst_pixelflutsink_get_kernel (GST_VIDEO_INFO_FORMAT (&info));
+  self->passthrough = FALSE;
   GST_OBJECT_UNLOCK (self);
 
+  /* not comparable to the new frames */
+  gst_clear_buffer (&self->prev_buffer);
+
   return TRUE;
 
   /* ERRORS */
@@ -274,12 +587,72 @@ gst_pixelflutsink_set_property (GObject *object, guint prop_id, const GValue *va
     case PROP_OFFSET_TOP:
       self->offset_top = g_value_get_int (value);
       break;
+    case PROP_SCALE_WIDTH:
+      self->scale_width = g_value_get_uint (value);
+      break;
+    case PROP_SCALE_HEIGHT:
+      self->scale_height = g_value_get_uint (value);
+      break;
     case PROP_PIXELS_PER_PACKET:
       self->pixels_per_packet = g_value_get_uint (value);
+      if (self->pixels_per_packet)
+        self->current_ppp = self->pixels_per_packet;
       break;
     case PROP_STRATEGY:
       self->strategy = g_value_get_enum (value);
       break;
+    case PROP_ORDER:
+      self->order = g_value_get_enum (value);
+      break;
+    case PROP_BACKGROUND:
+      self->background = g_value_get_uint (value);
+      break;
+    case PROP_STANDBY_CONNECTIONS:
+      self->standby_connections = g_value_get_uint (value);
+      break;
+    case PROP_CONNECT_TIMEOUT:
+      self->connect_timeout = g_value_get_uint (value) ?
+          g_value_get_uint (value) * GST_MSECOND : GST_CLOCK_TIME_NONE;
+      break;
+    case PROP_TRANSPORT:
+      self->transport = g_value_get_enum (value);
+      break;
+    case PROP_MTU:
+      self->mtu = g_value_get_uint (value);
+      break;
+    case PROP_IO_URING:
+      self->io_uring = g_value_get_boolean (value);
+      break;
+    case PROP_RECORD_LOCATION:
+      g_free (self->record_location);
+      self->record_location = g_value_dup_string (value);
+      break;
+    case PROP_BIND_ADDRESSES:
+      g_free (self->bind_addresses);
+      self->bind_addresses = g_value_dup_string (value);
+      break;
+    case PROP_COLOR_LUT:
+      g_free (self->color_lut);
+      self->color_lut = g_value_dup_string (value);
+      break;
+    case PROP_SHARED_POOL:
+      self->shared_pool = g_value_get_boolean (value);
+      break;
+    case PROP_PACING:
+      self->pacing = g_value_get_boolean (value);
+      break;
+    case PROP_CUT_OFF:
+      self->cut_off = g_value_get_boolean (value);
+      break;
+    case PROP_LATENCY_MARKER:
+      self->latency_marker = g_value_get_boolean (value);
+      break;
+    case PROP_MARKER_X:
+      self->marker_x = g_value_get_uint (value);
+      break;
+    case PROP_MARKER_Y:
+      self->marker_y = g_value_get_uint (value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -301,10 +674,13 @@ gst_pixelflutsink_get_property (GObject *object, guint prop_id, GValue *value, G
       g_value_set_int (value, self->port);
       break;
     case PROP_FRAMES_SENT:
-      g_value_set_int (value, self->frames_sent);
+      g_value_set_uint64 (value, self->frames_sent);
       break;
     case PROP_BYTES_WRITTEN:
-      g_value_set_int (value, self->bytes_written);
+      g_value_set_uint64 (value, self->bytes_written);
+      break;
+    case PROP_PIXELS_SENT:
+      g_value_set_uint64 (value, self->pixels_sent);
       break;
     case PROP_OFFSET_TOP:
       g_value_set_int (value, self->offset_top);
@@ -312,9 +688,18 @@ gst_pixelflutsink_get_property (GObject *object, guint prop_id, GValue *value, G
     case PROP_OFFSET_LEFT:
       g_value_set_int (value, self->offset_left);
       break;
+    case PROP_SCALE_WIDTH:
+      g_value_set_uint (value, self->scale_width);
+      break;
+    case PROP_SCALE_HEIGHT:
+      g_value_set_uint (value, self->scale_height);
+      break;
     case PROP_PIXELS_PER_PACKET:
       g_value_set_uint (value, self->pixels_per_packet);
       break;
+    case PROP_CURRENT_PPP:
+      g_value_set_uint (value, self->current_ppp);
+      break;
     case PROP_CANVAS_WIDTH:
       g_value_set_uint (value, self->canvas_width);
       break;
@@ -324,6 +709,67 @@ gst_pixelflutsink_get_property (GObject *object, guint prop_id, GValue *value, G
     case PROP_STRATEGY:
       g_value_set_enum (value, self->strategy);
       break;
+    case PROP_ORDER:
+      g_value_set_enum (value, self->order);
+      break;
+    case PROP_BACKGROUND:
+      g_value_set_uint (value, self->background);
+      break;
+    case PROP_STANDBY_CONNECTIONS:
+      g_value_set_uint (value, self->standby_connections);
+      break;
+    case PROP_CONNECT_TIMEOUT:
+      g_value_set_uint (value, GST_CLOCK_TIME_IS_VALID (self->connect_timeout) ?
+          GST_TIME_AS_MSECONDS (self->connect_timeout) : 0);
+      break;
+    case PROP_RECONNECTS:
+      g_value_set_uint64 (value, self->reconnects);
+      break;
+    case PROP_TRANSPORT:
+      g_value_set_enum (value, self->transport);
+      break;
+    case PROP_MTU:
+      g_value_set_uint (value, self->mtu);
+      break;
+    case PROP_IO_URING:
+      g_value_set_boolean (value, self->io_uring);
+      break;
+    case PROP_RECORD_LOCATION:
+      g_value_set_string (value, self->record_location);
+      break;
+    case PROP_BIND_ADDRESSES:
+      g_value_set_string (value, self->bind_addresses);
+      break;
+    case PROP_COLOR_LUT:
+      g_value_set_string (value, self->color_lut);
+      break;
+    case PROP_SHARED_POOL:
+      g_value_set_boolean (value, self->shared_pool);
+      break;
+    case PROP_DATAGRAMS_SENT:
+      g_value_set_uint64 (value, self->datagrams_sent);
+      break;
+    case PROP_DATAGRAMS_DROPPED:
+      g_value_set_uint64 (value, self->datagrams_dropped);
+      break;
+    case PROP_PACING:
+      g_value_set_boolean (value, self->pacing);
+      break;
+    case PROP_CUT_OFF:
+      g_value_set_boolean (value, self->cut_off);
+      break;
+    case PROP_FRAMES_CUT:
+      g_value_set_uint64 (value, self->frames_cut);
+      break;
+    case PROP_LATENCY_MARKER:
+      g_value_set_boolean (value, self->latency_marker);
+      break;
+    case PROP_MARKER_X:
+      g_value_set_uint (value, self->marker_x);
+      break;
+    case PROP_MARKER_Y:
+      g_value_set_uint (value, self->marker_y);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -331,353 +777,2563 @@ gst_pixelflutsink_get_property (GObject *object, guint prop_id, GValue *value, G
   GST_OBJECT_UNLOCK (self);
 }
 
-static gboolean gst_pixelflutsink_establish_connection (GstPixelflutSink *self)
+static GstPad *
+gst_pixelflutsink_request_new_pad (GstElement * element, GstPadTemplate * templ,
+    const gchar * name, const GstCaps * caps)
 {
-  gboolean is_open;
-  gchar *host;
-  int port;
-  GError *err = NULL;
-  GSocketClient *client;
-  GSocketConnection *connection;
-  GOutputStream *ostream = NULL;
-  GDataInputStream *istream = NULL;
-  char *readbuf;
-  gsize rret;
-  int scanret, x, y;
-  gboolean ret = FALSE;
+  GstPixelflutSink *self = GST_PIXELFLUTSINK (element);
+  GstPad *pad;
+  gchar *pad_name;
+  guint serial, zorder;
 
   GST_OBJECT_LOCK (self);
-  is_open = self->is_open;
-  host = g_strdup (self->host);
-  port = self->port;
-  connection = self->connection;
-  ostream = self->ostream;
+  if (name && sscanf (name, "layer_%u", &serial) == 1 && serial >= self->next_layer)
+    self->next_layer = serial + 1;
+  else
+    serial = self->next_layer++;
+  /* stacked on top of the existing layers by default */
+  zorder = g_list_length (self->layers) + 1;
   GST_OBJECT_UNLOCK (self);
 
-  if (G_IS_SOCKET_CONNECTION (connection)) {
-    g_object_unref (connection);
-  }
+  pad_name = g_strdup_printf ("layer_%u", serial);
+  pad = g_object_new (GST_TYPE_PIXELFLUT_LAYER_PAD, "name", pad_name,
+      "direction", GST_PAD_SINK, "template", templ, "zorder", zorder, NULL);
+  g_free (pad_name);
+
+  /* also activates the pad in PAUSED and PLAYING */
+  if (!gst_element_add_pad (element, pad))
+    goto add_failed;
+
+  GST_OBJECT_LOCK (self);
+  self->layers = g_list_append (self->layers, gst_object_ref (pad));
+  GST_OBJECT_UNLOCK (self);
+
+  GST_DEBUG_OBJECT (self, "added layer %" GST_PTR_FORMAT " at z-order %u", pad, zorder);
 
-  client = g_socket_client_new ();
-  connection = g_socket_client_connect_to_host (client, host, port, self->cancellable, &err);
-  g_clear_object (&client);
+  return pad;
 
-  if (connection) {
-    ostream = g_io_stream_get_output_stream (G_IO_STREAM (connection));
+  /* ERRORS */
+add_failed:
+  {
+    GST_WARNING_OBJECT (self, "could not add pad %s", GST_PAD_NAME (pad));
+    gst_object_unref (pad);
+    return NULL;
   }
+}
 
-  if (ostream) {
-    GST_DEBUG_OBJECT (ostream, "established connection to %s:%d", host, port);
-  } else {
-    goto connect_failed;
+static void
+gst_pixelflutsink_release_pad (GstElement * element, GstPad * pad)
+{
+  GstPixelflutSink *self = GST_PIXELFLUTSINK (element);
+  GList *link;
+
+  GST_DEBUG_OBJECT (self, "releasing layer %" GST_PTR_FORMAT, pad);
+
+  GST_OBJECT_LOCK (self);
+  link = g_list_find (self->layers, pad);
+  if (link)
+    self->layers = g_list_delete_link (self->layers, link);
+  GST_OBJECT_UNLOCK (self);
+
+  if (!link)
+    return;
+
+  /* wakes up the streaming thread waiting in the chain function */
+  gst_pad_set_active (pad, FALSE);
+  gst_element_remove_pad (element, pad);
+  gst_object_unref (pad);
+}
+
+/* Datagrams go to the same address and port the TCP connection
+ * reached the server on */
+static gboolean
+gst_pixelflutsink_open_udp (GstPixelflutSink *self, GstPixelflutConnection *conn,
+    GError **err)
+{
+  GSocketAddress *address;
+  GSocket *socket;
+
+  address = g_socket_connection_get_remote_address (conn->connection, err);
+  if (!address)
+    return FALSE;
+
+  socket = g_socket_new (g_socket_address_get_family (address),
+      G_SOCKET_TYPE_DATAGRAM, G_SOCKET_PROTOCOL_UDP, err);
+  if (!socket) {
+    g_object_unref (address);
+    return FALSE;
   }
 
-  if (!g_output_stream_printf (ostream, NULL, self->cancellable, &err, "SIZE\n", 5)) {
-    goto size_failed;
+  /* stick to the source address picked for the connection */
+  if (self->bind_addresses) {
+    GSocketAddress *tcp_local, *local;
+    gboolean bound;
+
+    tcp_local = g_socket_connection_get_local_address (conn->connection, err);
+    if (!tcp_local) {
+      g_object_unref (address);
+      g_object_unref (socket);
+      return FALSE;
+    }
+    local = g_inet_socket_address_new (
+        g_inet_socket_address_get_address (G_INET_SOCKET_ADDRESS (tcp_local)), 0);
+    g_object_unref (tcp_local);
+    bound = g_socket_bind (socket, local, FALSE, err);
+    g_object_unref (local);
+    if (!bound) {
+      g_object_unref (address);
+      g_object_unref (socket);
+      return FALSE;
+    }
   }
 
-  istream = g_data_input_stream_new (g_io_stream_get_input_stream (G_IO_STREAM (connection)));
-  readbuf = g_data_input_stream_read_line_utf8 (istream, &rret, self->cancellable, &err);
-  if (!readbuf || rret < 8) {
-    err = g_error_new (GST_RESOURCE_ERROR, GST_RESOURCE_ERROR_FAILED,
-        "Couldn't receive SIZE reply");
-      goto size_failed;
+  if (!g_socket_connect (socket, address, self->cancellable, err)) {
+    g_object_unref (address);
+    g_object_unref (socket);
+    return FALSE;
   }
+  g_object_unref (address);
 
-  scanret = sscanf(readbuf, "SIZE %d%d", &x, &y);
-  if (scanret == 2) {
-    GST_INFO_OBJECT (self, "canvas size is (%dx%d)", x, y);
-  } else {
-    err = g_error_new (GST_RESOURCE_ERROR, GST_RESOURCE_ERROR_FAILED,
-      "Couldn't parse canvas reply '%s'", readbuf);
-    goto size_failed;
+  /* a full send buffer drops datagrams instead of stalling the stream */
+  g_socket_set_blocking (socket, FALSE);
+
+  GST_DEBUG_OBJECT (self, "sending datagrams of up to %u bytes", self->mtu);
+
+  GST_OBJECT_LOCK (self);
+  self->udp_socket = socket;
+  GST_OBJECT_UNLOCK (self);
+
+  return TRUE;
+}
+
+/* Make sure there is a connection to send on, waiting at most @timeout
+ * for the pool to come up with one. Returns GST_FLOW_CUSTOM_SUCCESS if
+ * there was none yet when the timeout expired without a final error. */
+static GstFlowReturn
+gst_pixelflutsink_ensure_connection (GstPixelflutSink *self, GstClockTime timeout)
+{
+  GstPixelflutPool *pool;
+  GstPixelflutConnection *conn;
+  GError *err = NULL;
+  gboolean shared;
+  guint x, y;
+
+  if (self->conn || self->leasing)
+    return GST_FLOW_OK;
+
+  GST_OBJECT_LOCK (self);
+  pool = gst_object_ref (self->pool);
+  shared = self->shared_pool;
+  GST_OBJECT_UNLOCK (self);
+
+  if (shared)
+    conn = gst_pixelflut_pool_lease (pool, timeout, self->cancellable, &err);
+  else
+    conn = gst_pixelflut_pool_take (pool, timeout, self->cancellable, &err);
+  if (!conn)
+    goto connect_failed;
+
+  if (self->transport == GST_PIXELFLUTSINK_TRANSPORT_UDP && !self->udp_socket &&
+      !gst_pixelflutsink_open_udp (self, conn, &err)) {
+    if (shared)
+      gst_pixelflut_pool_release (pool, conn, FALSE);
+    else
+      gst_pixelflut_connection_free (conn);
+    goto connect_failed;
   }
 
-  ret = TRUE;
-  goto cleanup;
+  GST_OBJECT_LOCK (pool);
+  x = pool->canvas_width;
+  y = pool->canvas_height;
+  GST_OBJECT_UNLOCK (pool);
+  GST_INFO_OBJECT (self, "canvas size is (%dx%d)", x, y);
+
+  GST_OBJECT_LOCK (self);
+  if (shared)
+    self->leasing = TRUE;
+  else
+    self->conn = conn;
+  self->canvas_width = x;
+  self->canvas_height = y;
+  GST_OBJECT_UNLOCK (self);
+
+  /* leased again for each packet */
+  if (shared)
+    gst_pixelflut_pool_release (pool, conn, FALSE);
+
+  gst_object_unref (pool);
+
+  return GST_FLOW_OK;
 
   connect_failed:
   {
+    GstFlowReturn ret;
+
     if (g_error_matches (err, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
       GST_DEBUG_OBJECT (self, "Cancelled connecting");
+      ret = GST_FLOW_FLUSHING;
+    } else if (timeout == 0 && g_error_matches (err, G_IO_ERROR, G_IO_ERROR_TIMED_OUT)) {
+      ret = GST_FLOW_CUSTOM_SUCCESS;
     } else {
-      GST_ELEMENT_ERROR (self, RESOURCE, OPEN_READ, (NULL),
-          ("Failed to connect to host '%s:%d': %s", host, port,
-              err->message));
-    }
-    goto cleanup;
-  }
-  size_failed:
-  {
-    if (g_error_matches (err, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
-      GST_DEBUG_OBJECT (self, "Cancelled connecting");
-    } else {
-      GST_ELEMENT_ERROR (self, RESOURCE, OPEN_WRITE, (NULL),
-          ("Failed to query SIZE from Pixelflut server",
-              err ? err->message : ""));
+      GST_ELEMENT_ERROR (self, RESOURCE, OPEN_READ_WRITE, (NULL),
+          ("Failed to connect to Pixelflut server '%s:%d': %s", pool->host,
+              pool->port, err->message));
+      ret = GST_FLOW_ERROR;
     }
-    goto cleanup;
-  }
-  cleanup:
-  {
     g_clear_error (&err);
-    g_object_unref (istream);
-    g_free (host);
-    GST_OBJECT_LOCK (self);
-    self->connection = connection;
-    self->ostream = ostream;
-    self->canvas_width = x;
-    self->canvas_height = y;
-    GST_OBJECT_UNLOCK (self);
+    gst_object_unref (pool);
     return ret;
   }
 }
 
-
+/* Replace a dead connection, preferably by a warm standby one */
 static gboolean
-gst_pixelflutsink_start (GstBaseSink * bsink)
+gst_pixelflutsink_failover (GstPixelflutSink *self)
 {
-  GstPixelflutSink *self = GST_PIXELFLUTSINK (bsink);
-  gboolean is_open;
-  gboolean ret;
+  GstPixelflutConnection *old_conn;
+  GstClockTime timeout;
 
-  GST_DEBUG_OBJECT (self, "starting");
+  GST_OBJECT_LOCK (self);
+  old_conn = self->conn;
+  self->conn = NULL;
+  timeout = self->connect_timeout;
+  GST_OBJECT_UNLOCK (self);
+
+  gst_pixelflut_connection_free (old_conn);
+
+  if (gst_pixelflutsink_ensure_connection (self, timeout) != GST_FLOW_OK)
+    return FALSE;
 
+  /* only count connections that were really replaced */
   GST_OBJECT_LOCK (self);
-  is_open = self->is_open;
+  self->reconnects++;
   GST_OBJECT_UNLOCK (self);
 
-  if (is_open) {
-    return TRUE;
+  return TRUE;
+}
+
+static void
+gst_pixelflutsink_set_context (GstElement * element, GstContext * context)
+{
+  GstPixelflutSink *self = GST_PIXELFLUTSINK (element);
+
+  if (gst_context_has_context_type (context, PIXELFLUT_POOL_CONTEXT_TYPE)) {
+    GST_OBJECT_LOCK (self);
+    gst_context_replace (&self->pool_context, context);
+    GST_OBJECT_UNLOCK (self);
   }
 
-  ret = gst_pixelflutsink_establish_connection (self);
+  GST_ELEMENT_CLASS (gst_pixelflutsink_parent_class)->set_context (element, context);
+}
+
+/* The pool for @key in the context set on the sink, if any */
+static GstPixelflutPool *
+gst_pixelflutsink_pool_from_context (GstPixelflutSink *self, const gchar *key)
+{
+  GstPixelflutPool *pool = NULL;
 
   GST_OBJECT_LOCK (self);
-  self->bytes_written = 0;
-  self->is_open = ret;
+  if (self->pool_context) {
+    const GstStructure *s = gst_context_get_structure (self->pool_context);
+    gst_structure_get (s, key, GST_TYPE_PIXELFLUT_POOL, &pool, NULL);
+  }
   GST_OBJECT_UNLOCK (self);
 
-  return ret;
+  return pool;
 }
 
-static gboolean
-gst_pixelflutsink_stop (GstBaseSink * bsink)
+/* Finds the pool other sinks use for the server: in a context set on the
+ * sink before, by asking upstream, the bins and the application with a
+ * context query and a need-context message, and finally in the pools of
+ * the process. A pool found in the process is published with a
+ * have-context message so that the application can pass it on. */
+static GstPixelflutPool *
+gst_pixelflutsink_acquire_shared_pool (GstPixelflutSink *self, const gchar *host,
+    gint port)
 {
-  GstPixelflutSink *self = GST_PIXELFLUTSINK (bsink);
-  GError *err = NULL;
-  gboolean is_open;
-  GSocketConnection *connection;
-  GOutputStream *ostream;
+  GstPixelflutPool *pool;
+  GstContext *context;
+  GstStructure *s;
+  GstQuery *query;
+  gchar *key;
+
+  key = g_strdup_printf ("%s:%d", host, port);
+
+  if ((pool = gst_pixelflutsink_pool_from_context (self, key)))
+    goto done;
+
+  query = gst_query_new_context (PIXELFLUT_POOL_CONTEXT_TYPE);
+  if (gst_pad_peer_query (GST_BASE_SINK_PAD (self), query)) {
+    gst_query_parse_context (query, &context);
+    if (context)
+      gst_element_set_context (GST_ELEMENT (self), context);
+  }
+  gst_query_unref (query);
 
-  GST_DEBUG_OBJECT (self, "stop");
+  if ((pool = gst_pixelflutsink_pool_from_context (self, key)))
+    goto done;
+
+  /* bins and bus sync handlers answer with gst_element_set_context() */
+  gst_element_post_message (GST_ELEMENT (self),
+      gst_message_new_need_context (GST_OBJECT (self), PIXELFLUT_POOL_CONTEXT_TYPE));
+
+  if ((pool = gst_pixelflutsink_pool_from_context (self, key)))
+    goto done;
+
+  pool = gst_pixelflut_pool_get_shared (host, port);
 
+  /* keep the pools for other servers from the previous context */
   GST_OBJECT_LOCK (self);
-  is_open = self->is_open;
-  ostream = self->ostream;
-  connection = self->connection;
+  if (self->pool_context)
+    context = gst_context_copy (self->pool_context);
+  else
+    context = gst_context_new (PIXELFLUT_POOL_CONTEXT_TYPE, TRUE);
   GST_OBJECT_UNLOCK (self);
+  s = gst_context_writable_structure (context);
+  gst_structure_set (s, key, GST_TYPE_PIXELFLUT_POOL, pool, NULL);
 
-  if (is_open)
-    return TRUE;
+  gst_element_set_context (GST_ELEMENT (self), context);
+  gst_element_post_message (GST_ELEMENT (self),
+      gst_message_new_have_context (GST_OBJECT (self), context));
 
-  if (ostream) {
-    GST_DEBUG_OBJECT (ostream, "closing ostream");
+done:
+  GST_DEBUG_OBJECT (self, "using shared pool %" GST_PTR_FORMAT " for %s", pool, key);
+  g_free (key);
 
-    if (!g_output_stream_close (ostream, NULL, &err)) {
-      GST_ERROR_OBJECT (self, "Failed to close stream: %s", err->message);
-      g_clear_error (&err);
-    }
-    g_object_unref (ostream);
-  }
+  return pool;
+}
 
-  if (connection) {
-    GST_DEBUG_OBJECT (connection, "closing connection");
+/* The io_uring sender is optional, without it the GIO output stream of
+ * the connection is used */
+static void
+gst_pixelflutsink_open_uring (GstPixelflutSink *self)
+{
+#ifdef HAVE_LIBURING
+  GstPixelflutUring *uring;
+  GError *err = NULL;
 
-    if (!g_io_stream_close (G_IO_STREAM (connection), NULL, &err)) {
-      GST_ERROR_OBJECT (self, "Failed to close socket: %s", err->message);
-      g_clear_error (&err);
-    }
-    g_object_unref (connection);
+  uring = gst_pixelflut_uring_new (URING_ARENAS, PX_MAX_LEN * PPP_MAX + 1, &err);
+  if (!uring) {
+    GST_WARNING_OBJECT (self, "falling back to GIO: %s", err->message);
+    g_clear_error (&err);
+    return;
   }
 
+  GST_INFO_OBJECT (self, "sending with io_uring, zerocopy %d",
+      gst_pixelflut_uring_is_zerocopy (uring));
+
   GST_OBJECT_LOCK (self);
-  self->ostream = NULL;
-  self->connection = NULL;
-  self->is_open = FALSE;
+  self->uring = uring;
+  self->arena = NULL;
   GST_OBJECT_UNLOCK (self);
-
-  return TRUE;
+#else
+  GST_WARNING_OBJECT (self, "built without io_uring support, using GIO");
+#endif
 }
 
 static gboolean
-gst_pixelflutsink_unlock (GstBaseSink * bsink)
+gst_pixelflutsink_open_recorder (GstPixelflutSink *self)
 {
-  GstPixelflutSink *self = GST_PIXELFLUTSINK (bsink);
+  GstPixelflutRecorder *recorder;
+  GError *err = NULL;
+  gchar *location;
 
-  GST_DEBUG_OBJECT (self, "set to flushing");
-  /* Unlock pending access to resources */
-  g_cancellable_cancel (self->cancellable);
+  GST_OBJECT_LOCK (self);
+  location = g_strdup (self->record_location);
+  GST_OBJECT_UNLOCK (self);
+
+  if (!location || !*location) {
+    g_free (location);
+    return TRUE;
+  }
+
+  recorder = gst_pixelflut_recorder_new (location, &err);
+  if (!recorder) {
+    GST_ELEMENT_ERROR (self, RESOURCE, OPEN_WRITE, ("%s", err->message), (NULL));
+    g_clear_error (&err);
+    g_free (location);
+    return FALSE;
+  }
+
+  GST_INFO_OBJECT (self, "recording to %s", location);
+  g_free (location);
+
+  self->recorder = recorder;
 
   return TRUE;
 }
 
 static gboolean
-gst_pixelflutsink_unlock_stop (GstBaseSink * bsink)
+gst_pixelflutsink_load_lut (GstPixelflutSink *self)
 {
-  GstPixelflutSink *self = GST_PIXELFLUTSINK (bsink);
+  GstPixelflutLut *lut;
+  GError *err = NULL;
+  gchar *location;
 
-  GST_DEBUG_OBJECT (self, "unset flushing");
-  /* Clear previous unlock request */
-  g_cancellable_reset (self->cancellable);
+  GST_OBJECT_LOCK (self);
+  location = g_strdup (self->color_lut);
+  GST_OBJECT_UNLOCK (self);
+
+  if (!location || !*location) {
+    g_free (location);
+    return TRUE;
+  }
+
+  lut = gst_pixelflut_lut_load (location, &err);
+  if (!lut) {
+    GST_ELEMENT_ERROR (self, RESOURCE, OPEN_READ, ("%s", err->message), (NULL));
+    g_clear_error (&err);
+    g_free (location);
+    return FALSE;
+  }
+
+  GST_INFO_OBJECT (self, "correcting colors with %s", location);
+  g_free (location);
+
+  self->lut = lut;
 
   return TRUE;
 }
 
-static GstFlowReturn
-gst_pixelflutsink_send_frame (GstVideoSink * vsink, GstBuffer * buffer)
+static gboolean
+gst_pixelflutsink_start (GstBaseSink * bsink)
 {
-  GstPixelflutSink *self = GST_PIXELFLUTSINK (vsink);
+  GstPixelflutSink *self = GST_PIXELFLUTSINK (bsink);
+  GstPixelflutPool *pool;
+  gboolean is_open, shared, configure;
+  guint standby;
+  GstClockTime timeout;
+  gchar *host, *bind_addresses;
+  gint port;
+  GError *err = NULL;
+  gboolean ret;
+
+  GST_DEBUG_OBJECT (self, "starting");
+
+  GST_OBJECT_LOCK (self);
+  is_open = self->is_open;
+  standby = self->standby_connections;
+  timeout = self->connect_timeout;
+  shared = self->shared_pool;
+  host = g_strdup (self->host);
+  port = self->port;
+  bind_addresses = g_strdup (self->bind_addresses);
+  if (!is_open)
+    gst_clear_object (&self->pool);
+  GST_OBJECT_UNLOCK (self);
+
+  if (is_open) {
+    g_free (host);
+    g_free (bind_addresses);
+    return TRUE;
+  }
+
+  if (shared)
+    pool = gst_pixelflutsink_acquire_shared_pool (self, host, port);
+  else
+    pool = gst_pixelflut_pool_new (host, port);
+  g_free (host);
+
+  GST_OBJECT_LOCK (self);
+  self->pool = pool;
+  GST_OBJECT_UNLOCK (self);
+
+  /* a shared pool keeps the settings of the sink that started it */
+  GST_OBJECT_LOCK (pool);
+  configure = !pool->running;
+  GST_OBJECT_UNLOCK (pool);
+
+  if (configure && !gst_pixelflut_pool_set_bind_addresses (pool, bind_addresses, &err)) {
+    GST_ELEMENT_ERROR (self, RESOURCE, SETTINGS,
+        ("Invalid bind-addresses '%s'", bind_addresses), ("%s", err->message));
+    g_clear_error (&err);
+    g_free (bind_addresses);
+    goto failed;
+  }
+  g_free (bind_addresses);
+
+  if (!gst_pixelflutsink_load_lut (self) || !gst_pixelflutsink_open_recorder (self))
+    goto failed;
+
+  /* connecting happens in the background, the first frame waits for it */
+  ret = gst_pixelflut_pool_start (pool, standby, timeout);
+  if (!ret)
+    goto failed;
+
+  if (ret && self->io_uring && self->transport == GST_PIXELFLUTSINK_TRANSPORT_TCP) {
+    if (shared)
+      GST_WARNING_OBJECT (self, "not using io_uring with a shared pool");
+    else
+      gst_pixelflutsink_open_uring (self);
+  }
+
+  GST_OBJECT_LOCK (self);
+  self->bytes_written = 0;
+  self->pixels_sent = 0;
+  self->reconnects = 0;
+  self->datagrams_sent = 0;
+  self->datagrams_dropped = 0;
+  self->avg_render_time = GST_CLOCK_TIME_NONE;
+  self->avg_accepted = 0;
+  self->marker_count = 0;
+  if (!self->pixels_per_packet)
+    self->current_ppp = AUTO_PPP_START;
+  self->is_open = ret;
+  GST_OBJECT_UNLOCK (self);
+
+  return ret;
+
+failed:
+  {
+    /* basesink doesn't stop() after a failed start() */
+    if (self->recorder) {
+      gst_pixelflut_recorder_close (self->recorder, NULL);
+      self->recorder = NULL;
+    }
+    g_clear_pointer (&self->lut, gst_pixelflut_lut_free);
+
+    GST_OBJECT_LOCK (self);
+    self->pool = NULL;
+    GST_OBJECT_UNLOCK (self);
+    gst_object_unref (pool);
+
+    return FALSE;
+  }
+}
+
+static gboolean
+gst_pixelflutsink_stop (GstBaseSink * bsink)
+{
+  GstPixelflutSink *self = GST_PIXELFLUTSINK (bsink);
+  GstPixelflutPool *pool;
+  GstPixelflutConnection *conn;
+  GSocket *udp_socket;
+  gboolean is_open;
+
+  GST_DEBUG_OBJECT (self, "stop");
+
+  if (self->recorder) {
+    GError *err = NULL;
+
+    if (!gst_pixelflut_recorder_close (self->recorder, &err)) {
+      GST_ELEMENT_WARNING (self, RESOURCE, WRITE, ("%s", err->message), (NULL));
+      g_clear_error (&err);
+    }
+    self->recorder = NULL;
+  }
+
+  g_clear_pointer (&self->lut, gst_pixelflut_lut_free);
+
+#ifdef HAVE_LIBURING
+  /* before the socket goes away, to not cut off what was queued */
+  if (self->uring) {
+    GError *err = NULL;
+
+    if (!gst_pixelflut_uring_drain (self->uring, self->cancellable, &err)) {
+      GST_WARNING_OBJECT (self, "not everything queued was sent: %s", err->message);
+      g_clear_error (&err);
+    }
+    gst_pixelflut_uring_free (self->uring);
+    self->uring = NULL;
+    self->arena = NULL;
+  }
+#endif
+
+  GST_OBJECT_LOCK (self);
+  pool = self->pool;
+  conn = self->conn;
+  udp_socket = self->udp_socket;
+  is_open = self->is_open;
+  self->pool = NULL;
+  self->conn = NULL;
+  self->udp_socket = NULL;
+  self->leasing = FALSE;
+  self->is_open = FALSE;
+  GST_OBJECT_UNLOCK (self);
+
+  if (pool) {
+    /* only the last user really stops a shared pool */
+    if (is_open)
+      gst_pixelflut_pool_stop (pool);
+    gst_object_unref (pool);
+  }
+
+  GST_DEBUG_OBJECT (self, "closing connection");
+  gst_pixelflut_connection_free (conn);
+
+  if (udp_socket) {
+    g_socket_close (udp_socket, NULL);
+    g_object_unref (udp_socket);
+  }
+
+  /* the next server gets all layers drawn again */
+  g_clear_pointer (&self->composite, g_free);
+  g_clear_pointer (&self->tiles, g_hash_table_unref);
+  self->tiles_width = 0;
+  self->tiles_height = 0;
+
+  return TRUE;
+}
+
+
+static gboolean
+gst_pixelflutsink_unlock (GstBaseSink * bsink)
+{
+  GstPixelflutSink *self = GST_PIXELFLUTSINK (bsink);
+
+  GST_DEBUG_OBJECT (self, "set to flushing");
+  /* Unlock pending access to resources */
+  g_cancellable_cancel (self->cancellable);
+
+  return TRUE;
+}
+
+static gboolean
+gst_pixelflutsink_unlock_stop (GstBaseSink * bsink)
+{
+  GstPixelflutSink *self = GST_PIXELFLUTSINK (bsink);
+
+  GST_DEBUG_OBJECT (self, "unset flushing");
+  /* Clear previous unlock request */
+  g_cancellable_reset (self->cancellable);
+
+  return TRUE;
+}
+
+/* Current running time as seen by the sink, i.e. corrected by the
+ * configured latency and render delay, or GST_CLOCK_TIME_NONE without
+ * a clock. */
+static GstClockTime
+gst_pixelflutsink_get_running_time (GstPixelflutSink *self)
+{
+  GstBaseSink *bsink = GST_BASE_SINK (self);
+  GstClock *clock;
+  GstClockTime now, base_time, delay;
+
+  clock = gst_element_get_clock (GST_ELEMENT (self));
+  if (!clock)
+    return GST_CLOCK_TIME_NONE;
+
+  now = gst_clock_get_time (clock);
+  gst_object_unref (clock);
+
+  base_time = gst_element_get_base_time (GST_ELEMENT (self));
+  delay = gst_base_sink_get_latency (bsink) + gst_base_sink_get_render_delay (bsink);
+
+  if (now < base_time + delay)
+    return 0;
+
+  return now - base_time - delay;
+}
+
+/* Feed the time actually spent encoding and writing a frame (without the
+ * pacing waits) into the processing deadline, which ends up in the
+ * LATENCY query answer of GstBaseSink. */
+static void
+gst_pixelflutsink_update_render_time (GstPixelflutSink *self, GstClockTime busy)
+{
+  GstBaseSink *bsink = GST_BASE_SINK (self);
+  GstClockTime avg, deadline;
+
+  GST_OBJECT_LOCK (self);
+  if (GST_CLOCK_TIME_IS_VALID (self->avg_render_time))
+    self->avg_render_time = (7 * self->avg_render_time + busy) / 8;
+  else
+    self->avg_render_time = busy;
+  avg = self->avg_render_time;
+  GST_OBJECT_UNLOCK (self);
+
+  /* every change makes the pipeline recalculate its latency,
+   * so only report significant deviations */
+  deadline = gst_base_sink_get_processing_deadline (bsink);
+  if (avg > deadline + deadline / 4 || avg < deadline - deadline / 4) {
+    GST_DEBUG_OBJECT (self, "processing deadline %" GST_TIME_FORMAT " -> %"
+        GST_TIME_FORMAT, GST_TIME_ARGS (deadline), GST_TIME_ARGS (avg));
+    gst_base_sink_set_processing_deadline (bsink, avg);
+  }
+}
+
+/* Tell the application that the remainder of a frame was dropped */
+static void
+gst_pixelflutsink_post_qos (GstPixelflutSink *self, GstBuffer *buffer,
+    GstClockTime running_time, GstClockTimeDiff jitter)
+{
+  GstBaseSink *bsink = GST_BASE_SINK (self);
+  GstMessage *qos_msg;
+  GstClockTime stream_time;
+  guint64 frames_sent, frames_cut;
+
+  if (!gst_base_sink_is_qos_enabled (bsink))
+    return;
+
+  GST_OBJECT_LOCK (self);
+  stream_time = gst_segment_to_stream_time (&bsink->segment, GST_FORMAT_TIME,
+      GST_BUFFER_PTS (buffer));
+  frames_sent = self->frames_sent;
+  frames_cut = self->frames_cut;
+  GST_OBJECT_UNLOCK (self);
+
+  qos_msg = gst_message_new_qos (GST_OBJECT_CAST (self), FALSE, running_time,
+      stream_time, GST_BUFFER_PTS (buffer), GST_BUFFER_DURATION (buffer));
+  gst_message_set_qos_values (qos_msg, jitter, 1.0, 1000000);
+  gst_message_set_qos_stats (qos_msg, GST_FORMAT_BUFFERS, frames_sent, frames_cut);
+  gst_element_post_message (GST_ELEMENT_CAST (self), qos_msg);
+}
+
+static gboolean
+gst_pixelflutsink_write_packet (GstPixelflutSink *self, GOutputStream *ostream,
+    const gchar *packet, gsize len, gint *fragments_count, gsize *accepted,
+    GError **err)
+{
+  gsize fragment_written = 0;
+
+  while (fragment_written < len) {
+    gssize wret;
+    (*fragments_count)++;
+    wret = g_output_stream_write (ostream, packet + fragment_written,
+        len - fragment_written, self->cancellable, err);
+    if (wret < 0) {
+      GST_DEBUG_OBJECT (self, "only %" G_GSIZE_FORMAT " of %" G_GSIZE_FORMAT
+          " bytes written", fragment_written, len);
+      return FALSE;
+    }
+    if (accepted && fragment_written == 0)
+      *accepted = wret;
+    fragment_written += wret;
+    if (gst_debug_category_get_threshold (pixelflutsink_debug) >= GST_LEVEL_MEMDUMP) {
+      GST_TRACE_OBJECT (self, "sent: %.*s", (gint) len, packet);
+    }
+    GST_TRACE_OBJECT (self, "sent: wret=%" G_GSSIZE_FORMAT " fragment_written=%"
+                      G_GSIZE_FORMAT " fragments_count=%d",
+                      wret, fragment_written, *fragments_count);
+  }
+
+  return TRUE;
+}
+
+/* Adapt the batch size to what the socket takes: when the kernel doesn't
+ * accept a whole packet in one write, the batch shrinks to the amount it
+ * took, when writes return quickly it grows again. */
+static guint
+gst_pixelflutsink_adapt_ppp (GstPixelflutSink *self, guint ppp, gsize len,
+    guint pixels, gsize accepted, GstClockTime latency)
+{
+  guint new_ppp = ppp;
+
+  self->avg_accepted = self->avg_accepted ?
+      (7 * self->avg_accepted + accepted) / 8 : accepted;
+
+  if (accepted < len) {
+    /* socket buffer full: batch what a single write can take */
+    new_ppp = self->avg_accepted * pixels / len;
+  } else if (latency > AUTO_PPP_TARGET_LATENCY) {
+    new_ppp = ppp / 2;
+  } else if (latency < AUTO_PPP_TARGET_LATENCY / 4) {
+    new_ppp = ppp + ppp / 8 + 1;
+  }
+  new_ppp = CLAMP (new_ppp, AUTO_PPP_MIN, PPP_MAX);
+
+  if (new_ppp != ppp) {
+    GST_LOG_OBJECT (self, "ppp %u -> %u (accepted %" G_GSIZE_FORMAT " of %"
+        G_GSIZE_FORMAT " bytes in %" GST_TIME_FORMAT ")", ppp, new_ppp,
+        accepted, len, GST_TIME_ARGS (latency));
+    GST_OBJECT_LOCK (self);
+    self->current_ppp = new_ppp;
+    GST_OBJECT_UNLOCK (self);
+  }
+
+  return new_ppp;
+}
+
+/* called with the object lock held */
+static guint
+gst_pixelflutsink_get_ppp_locked (GstPixelflutSink *self, gboolean *auto_ppp)
+{
+  guint ppp = self->pixels_per_packet;
+
+  *auto_ppp = (ppp == 0);
+  if (*auto_ppp && (self->udp_socket || self->uring)) {
+    /* nothing to adapt to, fill up whole sendmmsg batches or arenas */
+    *auto_ppp = FALSE;
+    ppp = self->current_ppp = PPP_MAX;
+  } else if (*auto_ppp) {
+    ppp = self->current_ppp;
+  }
+
+  return ppp;
+}
+
+static gchar *
+gst_pixelflutsink_ensure_outbuf (GstPixelflutSink *self, guint ppp)
+{
+  gsize size = PX_MAX_LEN * ppp + 1;
+
+  if (self->outbuf_size < size) {
+    self->outbuf = g_realloc (self->outbuf, size);
+    self->outbuf_size = size;
+  }
+
+  return self->outbuf;
+}
+
+/* Splits a packet into datagrams of whole commands of at most mtu bytes
+ * and hands them to the kernel in batches with a single syscall each.
+ * Datagrams which don't fit into the socket buffer are dropped. */
+static gboolean
+gst_pixelflutsink_send_datagrams (GstPixelflutSink *self, const gchar *packet,
+    gsize len, gint *fragments_count, GError **err)
+{
+  GOutputVector vectors[UDP_BATCH];
+  GOutputMessage messages[UDP_BATCH];
+  guint n_messages = 0;
+  gsize pos = 0;
+  guint64 sent = 0, dropped = 0;
+
+  while (pos < len) {
+    gsize size = MIN (len - pos, self->mtu);
+
+    /* don't cut a command in half */
+    if (pos + size < len) {
+      while (size && packet[pos + size - 1] != '\n')
+        size--;
+      if (!size) {
+        g_set_error (err, G_IO_ERROR, G_IO_ERROR_MESSAGE_TOO_LARGE,
+            "command longer than mtu %u", self->mtu);
+        return FALSE;
+      }
+    }
+
+    vectors[n_messages].buffer = packet + pos;
+    vectors[n_messages].size = size;
+    messages[n_messages].address = NULL;
+    messages[n_messages].vectors = &vectors[n_messages];
+    messages[n_messages].num_vectors = 1;
+    messages[n_messages].bytes_sent = 0;
+    messages[n_messages].control_messages = NULL;
+    messages[n_messages].num_control_messages = 0;
+    n_messages++;
+    pos += size;
+
+    if (n_messages == UDP_BATCH || pos == len) {
+      gint mret;
+
+      (*fragments_count)++;
+      mret = g_socket_send_messages (self->udp_socket, messages, n_messages, 0,
+          self->cancellable, err);
+      if (mret < 0) {
+        if (!g_error_matches (*err, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK))
+          break;
+        g_clear_error (err);
+        mret = 0;
+      }
+      GST_TRACE_OBJECT (self, "sent %d of %u datagrams", mret, n_messages);
+      sent += mret;
+      dropped += n_messages - mret;
+      n_messages = 0;
+    }
+  }
+
+  GST_OBJECT_LOCK (self);
+  self->datagrams_sent += sent;
+  self->datagrams_dropped += dropped;
+  GST_OBJECT_UNLOCK (self);
+
+  return (*err == NULL);
+}
+
+#ifdef HAVE_LIBURING
+/* io_uring reports errors of earlier sends late, on a closed socket
+ * switch over and forget about whatever was still in flight */
+static gboolean
+gst_pixelflutsink_uring_failover (GstPixelflutSink *self, GError **err)
+{
+  if (!g_error_matches (*err, G_IO_ERROR, G_IO_ERROR_CONNECTION_CLOSED) &&
+      !g_error_matches (*err, G_IO_ERROR, G_IO_ERROR_BROKEN_PIPE))
+    return FALSE;
+
+  GST_INFO_OBJECT (self, "connection closed, switching over: %s", (*err)->message);
+  g_clear_error (err);
+  gst_pixelflut_uring_reset (self->uring);
+
+  if (!gst_pixelflutsink_failover (self)) {
+    if (g_cancellable_is_cancelled (self->cancellable))
+      g_set_error_literal (err, G_IO_ERROR, G_IO_ERROR_CANCELLED, "Cancelled");
+    else
+      g_set_error_literal (err, GST_RESOURCE_ERROR, GST_RESOURCE_ERROR_WRITE,
+          "Lost connection to Pixelflut server");
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+static gboolean
+gst_pixelflutsink_ensure_arena (GstPixelflutSink *self, GError **err)
+{
+  while (!self->arena) {
+    self->arena = gst_pixelflut_uring_get_arena (self->uring, self->cancellable, err);
+    if (!self->arena && !gst_pixelflutsink_uring_failover (self, err))
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* Queues the filled arena with io_uring and replaces it with the next
+ * free one */
+static gboolean
+gst_pixelflutsink_send_arena (GstPixelflutSink *self, gsize len,
+    gint *fragments_count, GError **err)
+{
+  for (;;) {
+    gint fd = g_socket_get_fd (g_socket_connection_get_socket (self->conn->connection));
+
+    if (gst_pixelflut_uring_send (self->uring, fd, self->arena, len, err))
+      break;
+    if (!gst_pixelflutsink_uring_failover (self, err))
+      return FALSE;
+  }
+  (*fragments_count)++;
+  self->arena = NULL;
+
+  return gst_pixelflutsink_ensure_arena (self, err);
+}
+#endif
+
+/* Writes a packet on the connection of a shared pool, waiting for the
+ * turn of the sink. A closed connection is replaced by the pool. */
+static gboolean
+gst_pixelflutsink_send_leased (GstPixelflutSink *self, const gchar *packet,
+    gsize len, gint *fragments_count, gsize *accepted, GError **err)
+{
+  GstClockTime timeout;
+
+  GST_OBJECT_LOCK (self);
+  timeout = self->connect_timeout;
+  GST_OBJECT_UNLOCK (self);
+
+  for (;;) {
+    GstPixelflutConnection *conn;
+    gboolean written, closed;
+
+    conn = gst_pixelflut_pool_lease (self->pool, timeout, self->cancellable, err);
+    if (!conn)
+      return FALSE;
+
+    written = gst_pixelflutsink_write_packet (self, conn->ostream, packet, len,
+        fragments_count, accepted, err);
+    closed = !written &&
+        (g_error_matches (*err, G_IO_ERROR, G_IO_ERROR_CONNECTION_CLOSED) ||
+        g_error_matches (*err, G_IO_ERROR, G_IO_ERROR_BROKEN_PIPE));
+    gst_pixelflut_pool_release (self->pool, conn, closed);
+
+    if (!closed)
+      return written;
+
+    GST_INFO_OBJECT (self, "shared connection closed, switching over: %s", (*err)->message);
+    g_clear_error (err);
+
+    GST_OBJECT_LOCK (self);
+    self->reconnects++;
+    GST_OBJECT_UNLOCK (self);
+  }
+}
+
+/* Writes a packet, switching to another connection and sending the
+ * packet again from its start when the server closed the socket. */
+static gboolean
+gst_pixelflutsink_send_packet (GstPixelflutSink *self, const gchar *packet,
+    gsize len, gint *fragments_count, gsize *accepted, GError **err)
+{
+  if (self->recorder &&
+      !gst_pixelflut_recorder_write (self->recorder, packet, len, err))
+    return FALSE;
+
+  if (self->udp_socket) {
+    if (accepted)
+      *accepted = len;
+    return gst_pixelflutsink_send_datagrams (self, packet, len, fragments_count, err);
+  }
+
+  if (self->leasing)
+    return gst_pixelflutsink_send_leased (self, packet, len, fragments_count,
+        accepted, err);
+
+#ifdef HAVE_LIBURING
+  if (self->uring) {
+    g_assert (packet == self->arena);
+    if (accepted)
+      *accepted = len;
+    return gst_pixelflutsink_send_arena (self, len, fragments_count, err);
+  }
+#endif
+
+  while (!gst_pixelflutsink_write_packet (self, self->conn->ostream, packet, len,
+          fragments_count, accepted, err)) {
+    if (!g_error_matches (*err, G_IO_ERROR, G_IO_ERROR_CONNECTION_CLOSED) &&
+        !g_error_matches (*err, G_IO_ERROR, G_IO_ERROR_BROKEN_PIPE))
+      return FALSE;
+
+    GST_INFO_OBJECT (self, "connection closed, switching over: %s", (*err)->message);
+    g_clear_error (err);
+
+    if (!gst_pixelflutsink_failover (self)) {
+      if (g_cancellable_is_cancelled (self->cancellable))
+        g_set_error_literal (err, G_IO_ERROR, G_IO_ERROR_CANCELLED, "Cancelled");
+      else
+        g_set_error_literal (err, GST_RESOURCE_ERROR, GST_RESOURCE_ERROR_WRITE,
+            "Lost connection to Pixelflut server");
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+static GstFlowReturn
+gst_pixelflutsink_preroll (GstBaseSink * bsink, GstBuffer * buffer)
+{
+  GstPixelflutSink *self = GST_PIXELFLUTSINK (bsink);
+  GstFlowReturn ret;
+
+  /* don't hold up the state change until the server answered */
+  ret = gst_pixelflutsink_ensure_connection (self, 0);
+  if (ret == GST_FLOW_CUSTOM_SUCCESS) {
+    GST_DEBUG_OBJECT (self, "not connected yet, skipping preroll frame");
+    return GST_FLOW_OK;
+  } else if (ret != GST_FLOW_OK) {
+    return ret;
+  }
+
+  return GST_BASE_SINK_CLASS (gst_pixelflutsink_parent_class)->preroll (bsink, buffer);
+}
+
+/* Sends a buffer of ready made commands as it is */
+static GstFlowReturn
+gst_pixelflutsink_send_commands (GstPixelflutSink *self, GstBuffer *buffer)
+{
+  GstBaseSink *bsink = GST_BASE_SINK (self);
+  GstMapInfo map;
+  GError *err = NULL;
+  gint fragments_count = 0;
+  gsize pos = 0;
+  GstClockTime running_time;
+  gint offset_left, offset_top;
+  guint canvas_w, canvas_h;
+  gint64 start;
+  GstFlowReturn ret;
+
+  if (!gst_buffer_map (buffer, &map, GST_MAP_READ))
+    goto invalid_buffer;
+
+  GST_OBJECT_LOCK (self);
+  offset_left = self->offset_left;
+  offset_top = self->offset_top;
+  canvas_w = self->canvas_width;
+  canvas_h = self->canvas_height;
+  running_time = gst_segment_to_running_time (&bsink->segment, GST_FORMAT_TIME,
+      GST_BUFFER_PTS (buffer));
+  GST_OBJECT_UNLOCK (self);
+
+  if (self->recorder) {
+    gst_pixelflut_recorder_begin_frame (self->recorder, running_time,
+        GST_BUFFER_DURATION (buffer), offset_left, offset_top, canvas_w, canvas_h);
+  }
+
+  start = g_get_monotonic_time ();
+
+  while (pos < map.size) {
+    const gchar *packet = (const gchar *) map.data + pos;
+    gsize len = map.size - pos;
+
+#ifdef HAVE_LIBURING
+    /* only the registered arenas can be sent with io_uring */
+    if (self->uring) {
+      if (!gst_pixelflutsink_ensure_arena (self, &err))
+        goto write_error;
+      len = MIN (len, PX_MAX_LEN * PPP_MAX);
+      memcpy (self->arena, packet, len);
+      packet = self->arena;
+    }
+#endif
+
+    if (!gst_pixelflutsink_send_packet (self, packet, len, &fragments_count,
+            NULL, &err))
+      goto write_error;
+    pos += len;
+  }
+
+  if (self->recorder)
+    gst_pixelflut_recorder_end_frame (self->recorder);
+
+  gst_pixelflutsink_update_render_time (self,
+      (g_get_monotonic_time () - start) * GST_USECOND);
+
+  GST_OBJECT_LOCK (self);
+  self->bytes_written += map.size;
+  self->frames_sent++;
+  GST_OBJECT_UNLOCK (self);
+
+  GST_LOG_OBJECT (self, "%" G_GSIZE_FORMAT " bytes of commands sent in %d fragments",
+      map.size, fragments_count);
+
+  gst_buffer_unmap (buffer, &map);
+
+  return GST_FLOW_OK;
+
+  /* ERRORS */
+invalid_buffer:
+  {
+    GST_WARNING_OBJECT (self, "invalid buffer");
+    return GST_FLOW_ERROR;
+  }
+write_error:
+  {
+    if (g_error_matches (err, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+      ret = GST_FLOW_FLUSHING;
+      GST_DEBUG_OBJECT (self, "Cancelled writing to socket");
+    } else {
+      GST_WARNING_OBJECT (self, "Error while sending commands, %" G_GSIZE_FORMAT
+          " of %" G_GSIZE_FORMAT " bytes written: %s", pos, map.size, err->message);
+      ret = GST_FLOW_ERROR;
+    }
+    gst_buffer_unmap (buffer, &map);
+    g_clear_error (&err);
+    return ret;
+  }
+}
+
+/* The size frames of @info are drawn at, called with the object lock held */
+static void
+gst_pixelflutsink_get_draw_size_locked (GstPixelflutSink *self,
+    const GstVideoInfo *info, gint *width, gint *height)
+{
+  gint w = GST_VIDEO_INFO_WIDTH (info);
+  gint h = GST_VIDEO_INFO_HEIGHT (info);
+
+  if (self->scale_width && self->scale_height) {
+    *width = self->scale_width;
+    *height = self->scale_height;
+  } else if (self->scale_width) {
+    *width = self->scale_width;
+    *height = MAX (1, gst_util_uint64_scale_int_round (h, self->scale_width, w));
+  } else if (self->scale_height) {
+    *width = MAX (1, gst_util_uint64_scale_int_round (w, self->scale_height, h));
+    *height = self->scale_height;
+  } else {
+    *width = w;
+    *height = h;
+  }
+}
+
+/* Reads the pixels of a mapped frame as 0xRRGGBBAA at the size it is
+ * drawn at, picking the nearest source pixel. YUV is converted on the
+ * fly, so only the pixels that actually get sent are ever looked at. */
+struct _GstPixelflutSinkSampler
+{
+  GstVideoFormat format;
+  const guint8 *planes[3];
+  gint strides[3];
+  gint offsets[4];
+  gint pixel_stride;
+  gboolean has_alpha;
+  /* YUV to RGB in fixed point with 8 fractional bits */
+  gint y_offset, y_scale;
+  gint rv, gu, gv, bu;
+  /* source column and row of each column and row drawn */
+  gint src_width;
+  guint *xmap;
+  guint *ymap;
+};
+
+static void
+gst_pixelflutsink_sampler_init (GstPixelflutSinkSampler *sampler,
+    GstVideoFrame *frame, gint width, gint height)
+{
+  const GstVideoInfo *info = &frame->info;
+  gint src_w = GST_VIDEO_FRAME_WIDTH (frame);
+  gint src_h = GST_VIDEO_FRAME_HEIGHT (frame);
+  gint i;
+
+  sampler->format = GST_VIDEO_FRAME_FORMAT (frame);
+  for (i = 0; i < 3; i++) {
+    sampler->planes[i] = i < GST_VIDEO_FRAME_N_PLANES (frame) ?
+        (const guint8 *) GST_VIDEO_FRAME_PLANE_DATA (frame, i) : NULL;
+    sampler->strides[i] = i < GST_VIDEO_FRAME_N_PLANES (frame) ?
+        GST_VIDEO_FRAME_PLANE_STRIDE (frame, i) : 0;
+  }
+  sampler->has_alpha = GST_VIDEO_INFO_HAS_ALPHA (info);
+  sampler->pixel_stride = GST_VIDEO_FRAME_COMP_PSTRIDE (frame, 0);
+  sampler->offsets[0] = GST_VIDEO_FRAME_COMP_OFFSET (frame, 0);
+  sampler->offsets[1] = GST_VIDEO_FRAME_COMP_OFFSET (frame, 1);
+  sampler->offsets[2] = GST_VIDEO_FRAME_COMP_OFFSET (frame, 2);
+  sampler->offsets[3] = sampler->has_alpha ? GST_VIDEO_FRAME_COMP_OFFSET (frame, 3) : 0;
+
+  if (GST_VIDEO_INFO_IS_YUV (info)) {
+    gdouble Kr, Kb, Kg, y_range, c_range;
+
+    if (!gst_video_color_matrix_get_Kr_Kb (info->colorimetry.matrix, &Kr, &Kb)) {
+      Kr = 0.299;
+      Kb = 0.114;
+    }
+    Kg = 1.0 - Kr - Kb;
+    if (info->colorimetry.range == GST_VIDEO_COLOR_RANGE_0_255) {
+      sampler->y_offset = 0;
+      y_range = c_range = 1.0;
+    } else {
+      sampler->y_offset = 16;
+      y_range = 255.0 / 219.0;
+      c_range = 255.0 / 224.0;
+    }
+    sampler->y_scale = y_range * 256 + 0.5;
+    sampler->rv = 2 * (1 - Kr) * c_range * 256 + 0.5;
+    sampler->bu = 2 * (1 - Kb) * c_range * 256 + 0.5;
+    sampler->gu = 2 * Kb * (1 - Kb) / Kg * c_range * 256 + 0.5;
+    sampler->gv = 2 * Kr * (1 - Kr) / Kg * c_range * 256 + 0.5;
+  }
+
+  sampler->src_width = src_w;
+  sampler->xmap = g_new (guint, width + height);
+  sampler->ymap = sampler->xmap + width;
+  for (i = 0; i < width; i++)
+    sampler->xmap[i] = ((guint64) (2 * i + 1) * src_w) / (2 * width);
+  for (i = 0; i < height; i++)
+    sampler->ymap[i] = ((guint64) (2 * i + 1) * src_h) / (2 * height);
+}
+
+static void
+gst_pixelflutsink_sampler_clear (GstPixelflutSinkSampler *sampler)
+{
+  g_clear_pointer (&sampler->xmap, g_free);
+  sampler->ymap = NULL;
+}
+
+static inline guint32
+gst_pixelflutsink_yuv_to_rgb (const GstPixelflutSinkSampler *s, gint y, gint u,
+    gint v)
+{
+  gint luma = (y - s->y_offset) * s->y_scale;
+  gint r, g, b;
+
+  u -= 128;
+  v -= 128;
+  r = CLAMP ((luma + s->rv * v + 128) >> 8, 0, 255);
+  g = CLAMP ((luma - s->gu * u - s->gv * v + 128) >> 8, 0, 255);
+  b = CLAMP ((luma + s->bu * u + 128) >> 8, 0, 255);
+
+  return ((guint32) r << 24) | (g << 16) | (b << 8) | 0xff;
+}
+
+static inline guint32
+gst_pixelflutsink_sample (const GstPixelflutSinkSampler *s, gint x, gint y)
+{
+  guint sx = s->xmap[x], sy = s->ymap[y];
+
+  switch (s->format) {
+    case GST_VIDEO_FORMAT_I420:
+      return gst_pixelflutsink_yuv_to_rgb (s, s->planes[0][sy * s->strides[0] + sx],
+          s->planes[1][(sy / 2) * s->strides[1] + sx / 2],
+          s->planes[2][(sy / 2) * s->strides[2] + sx / 2]);
+    case GST_VIDEO_FORMAT_NV12:{
+      const guint8 *uv = s->planes[1] + (sy / 2) * s->strides[1] + (sx / 2) * 2;
+
+      return gst_pixelflutsink_yuv_to_rgb (s, s->planes[0][sy * s->strides[0] + sx],
+          uv[0], uv[1]);
+    }
+    default:{
+      const guint8 *p = s->planes[0] + sy * s->strides[0] + sx * s->pixel_stride;
+
+      return ((guint32) p[s->offsets[0]] << 24) | (p[s->offsets[1]] << 16) |
+          (p[s->offsets[2]] << 8) | (s->has_alpha ? p[s->offsets[3]] : 0xff);
+    }
+  }
+}
+
+/* Kernels for the packed formats, with the byte of each component and
+ * -1 for no alpha as constants, so that the loop has no branches left */
+#define PIXELFLUT_PACKED_KERNEL(name, pstride, r, g, b, a) \
+static void \
+gst_pixelflutsink_kernel_##name (const GstPixelflutSinkSampler *s, gint x, \
+    gint y, gint step, gint n, guint32 *out) \
+{ \
+  const guint8 *row = s->planes[0] + s->ymap[y] * s->strides[0]; \
+  const guint *xmap = s->xmap + x; \
+  gint i; \
+  \
+  for (i = 0; i < n; i++) { \
+    const guint8 *p = row + xmap[i * step] * (pstride); \
+    \
+    out[i] = ((guint32) p[r] << 24) | (p[g] << 16) | (p[b] << 8) | \
+        ((a) < 0 ? 0xff : p[(a) < 0 ? 0 : (a)]); \
+  } \
+}
+
+PIXELFLUT_PACKED_KERNEL (argb, 4, 1, 2, 3, 0);
+PIXELFLUT_PACKED_KERNEL (bgra, 4, 2, 1, 0, 3);
+PIXELFLUT_PACKED_KERNEL (abgr, 4, 3, 2, 1, 0);
+PIXELFLUT_PACKED_KERNEL (rgba, 4, 0, 1, 2, 3);
+PIXELFLUT_PACKED_KERNEL (xrgb, 4, 1, 2, 3, -1);
+PIXELFLUT_PACKED_KERNEL (rgbx, 4, 0, 1, 2, -1);
+PIXELFLUT_PACKED_KERNEL (xbgr, 4, 3, 2, 1, -1);
+PIXELFLUT_PACKED_KERNEL (bgrx, 4, 2, 1, 0, -1);
+PIXELFLUT_PACKED_KERNEL (rgb, 3, 0, 1, 2, -1);
+PIXELFLUT_PACKED_KERNEL (bgr, 3, 2, 1, 0, -1);
+
+static void
+gst_pixelflutsink_kernel_i420 (const GstPixelflutSinkSampler *s, gint x, gint y,
+    gint step, gint n, guint32 *out)
+{
+  guint sy = s->ymap[y];
+  const guint8 *luma = s->planes[0] + sy * s->strides[0];
+  const guint8 *u = s->planes[1] + (sy / 2) * s->strides[1];
+  const guint8 *v = s->planes[2] + (sy / 2) * s->strides[2];
+  const guint *xmap = s->xmap + x;
+  gint i;
+
+  for (i = 0; i < n; i++) {
+    guint sx = xmap[i * step];
+
+    out[i] = gst_pixelflutsink_yuv_to_rgb (s, luma[sx], u[sx / 2], v[sx / 2]);
+  }
+}
+
+static void
+gst_pixelflutsink_kernel_nv12 (const GstPixelflutSinkSampler *s, gint x, gint y,
+    gint step, gint n, guint32 *out)
+{
+  guint sy = s->ymap[y];
+  const guint8 *luma = s->planes[0] + sy * s->strides[0];
+  const guint8 *uv = s->planes[1] + (sy / 2) * s->strides[1];
+  const guint *xmap = s->xmap + x;
+  gint i;
+
+  for (i = 0; i < n; i++) {
+    guint sx = xmap[i * step];
+
+    out[i] = gst_pixelflutsink_yuv_to_rgb (s, luma[sx], uv[(sx / 2) * 2],
+        uv[(sx / 2) * 2 + 1]);
+  }
+}
+
+/* any other format, through the generic sampler */
+static void
+gst_pixelflutsink_kernel_generic (const GstPixelflutSinkSampler *s, gint x,
+    gint y, gint step, gint n, guint32 *out)
+{
+  gint i;
+
+  for (i = 0; i < n; i++)
+    out[i] = gst_pixelflutsink_sample (s, x + i * step, y);
+}
+
+static const struct
+{
+  GstVideoFormat format;
+  GstPixelflutSinkKernel kernel;
+} pixelflut_kernels[] = {
+  {GST_VIDEO_FORMAT_ARGB, gst_pixelflutsink_kernel_argb},
+  {GST_VIDEO_FORMAT_BGRA, gst_pixelflutsink_kernel_bgra},
+  {GST_VIDEO_FORMAT_ABGR, gst_pixelflutsink_kernel_abgr},
+  {GST_VIDEO_FORMAT_RGBA, gst_pixelflutsink_kernel_rgba},
+  {GST_VIDEO_FORMAT_xRGB, gst_pixelflutsink_kernel_xrgb},
+  {GST_VIDEO_FORMAT_RGBx, gst_pixelflutsink_kernel_rgbx},
+  {GST_VIDEO_FORMAT_xBGR, gst_pixelflutsink_kernel_xbgr},
+  {GST_VIDEO_FORMAT_BGRx, gst_pixelflutsink_kernel_bgrx},
+  {GST_VIDEO_FORMAT_RGB, gst_pixelflutsink_kernel_rgb},
+  {GST_VIDEO_FORMAT_BGR, gst_pixelflutsink_kernel_bgr},
+  {GST_VIDEO_FORMAT_I420, gst_pixelflutsink_kernel_i420},
+  {GST_VIDEO_FORMAT_NV12, gst_pixelflutsink_kernel_nv12},
+};
+
+/* The kernel for frames of @format, picked once when the caps are set */
+static GstPixelflutSinkKernel
+gst_pixelflutsink_get_kernel (GstVideoFormat format)
+{
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (pixelflut_kernels); i++) {
+    if (pixelflut_kernels[i].format == format)
+      return pixelflut_kernels[i].kernel;
+  }
+
+  return gst_pixelflutsink_kernel_generic;
+}
+
+/* Whether the alpha of whole rows can be scanned, which takes packed
+ * formats with 4 bytes per pixel */
+static inline gboolean
+gst_pixelflutsink_sampler_can_scan_alpha (const GstPixelflutSinkSampler *s)
+{
+  return s->has_alpha && s->pixel_stride == 4;
+}
+
+/* The alpha bytes of two pixels in a 64 bit word */
+static inline guint64
+gst_pixelflutsink_alpha_mask (gint alpha_offset)
+{
+  guint8 bytes[8] = { 0 };
+  guint64 mask;
+
+  bytes[alpha_offset] = bytes[alpha_offset + 4] = 0xff;
+  memcpy (&mask, bytes, sizeof (mask));
+
+  return mask;
+}
+
+/* The first source column from @from on, below @to, of @row that isn't
+ * fully transparent, or @to. Four pixels are tested at once. */
+static guint
+gst_pixelflutsink_alpha_scan (const guint8 *row, gint alpha_offset, guint from,
+    guint to)
+{
+  guint64 mask = gst_pixelflutsink_alpha_mask (alpha_offset);
+  guint x = from;
+
+  for (; x + 4 <= to; x += 4) {
+    guint64 w0, w1;
+
+    memcpy (&w0, row + 4 * x, sizeof (w0));
+    memcpy (&w1, row + 4 * x + 8, sizeof (w1));
+    if ((w0 | w1) & mask)
+      break;
+  }
+  for (; x < to; x++) {
+    if (row[4 * x + alpha_offset])
+      return x;
+  }
+
+  return to;
+}
+
+/* One past the last source column below @to, from @from on, of @row
+ * that isn't fully transparent, or @from */
+static guint
+gst_pixelflutsink_alpha_scan_back (const guint8 *row, gint alpha_offset,
+    guint from, guint to)
+{
+  guint64 mask = gst_pixelflutsink_alpha_mask (alpha_offset);
+  guint x = to;
+
+  for (; x >= from + 4; x -= 4) {
+    guint64 w0, w1;
+
+    memcpy (&w0, row + 4 * (x - 4), sizeof (w0));
+    memcpy (&w1, row + 4 * (x - 4) + 8, sizeof (w1));
+    if ((w0 | w1) & mask)
+      break;
+  }
+  for (; x > from; x--) {
+    if (row[4 * (x - 1) + alpha_offset])
+      return x;
+  }
+
+  return from;
+}
+
+/* The first of the @width columns drawn that shows source column @sx or
+ * one right of it */
+static gint
+gst_pixelflutsink_sampler_column (const GstPixelflutSinkSampler *s, gint width,
+    guint sx)
+{
+  gint lo = 0, hi = width;
+
+  while (lo < hi) {
+    gint mid = lo + (hi - lo) / 2;
+
+    if (s->xmap[mid] < sx)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  return lo;
+}
+
+/* Fills @bounds with the first and one past the last column drawn of
+ * each row from @y_begin to @y_end that isn't fully transparent, empty
+ * rows get 0, 0. Rows drawn from the same source row are scanned once. */
+static void
+gst_pixelflutsink_get_row_bounds (const GstPixelflutSinkSampler *s, gint width,
+    gint y_begin, gint y_end, gint *bounds)
+{
+  gint alpha = s->offsets[3];
+  guint last_sy = G_MAXUINT;
+  gint begin = 0, end = 0;
+  gint y;
+
+  for (y = y_begin; y < y_end; y++) {
+    if (s->ymap[y] != last_sy) {
+      const guint8 *row = s->planes[0] + s->ymap[y] * s->strides[0];
+      guint first, last;
+
+      last_sy = s->ymap[y];
+      first = gst_pixelflutsink_alpha_scan (row, alpha, 0, s->src_width);
+      if (first == (guint) s->src_width) {
+        begin = end = 0;
+      } else {
+        last = gst_pixelflutsink_alpha_scan_back (row, alpha, first, s->src_width);
+        begin = gst_pixelflutsink_sampler_column (s, width, first);
+        end = gst_pixelflutsink_sampler_column (s, width, last);
+      }
+    }
+    bounds[2 * y] = begin;
+    bounds[2 * y + 1] = end;
+  }
+}
+
+/* How many of @from, @from + @step, ... are below @to */
+static inline gint
+gst_pixelflutsink_span_count (gint from, gint to, gint step)
+{
+  return to > from ? (to - from + step - 1) / step : 0;
+}
+
+static void
+gst_pixelflutsink_unmap_prev (GstVideoFrame *prev_frame,
+    GstPixelflutSinkSampler *prev_sampler)
+{
+  gst_pixelflutsink_sampler_clear (prev_sampler);
+  gst_video_frame_unmap (prev_frame);
+}
+
+/* Sends the packet assembled in @outbuf and starts the next one, adapting
+ * @ppp when it is automatic */
+static gboolean
+gst_pixelflutsink_flush_packet (GstPixelflutSink *self, gchar **outbuf,
+    gsize *packet_offset, guint *ppp_count, guint *ppp, gboolean auto_ppp,
+    gint *fragments_count, gsize *frame_written, GError **err)
+{
+  gsize accepted = 0;
+  gint64 write_start = g_get_monotonic_time ();
+
+  if (!gst_pixelflutsink_send_packet (self, *outbuf, *packet_offset,
+          fragments_count, &accepted, err))
+    return FALSE;
+
+  *frame_written += *packet_offset;
+  /* io_uring hands out a new arena for each packet */
+  *outbuf = self->uring ? self->arena : *outbuf;
+  if (auto_ppp) {
+    *ppp = gst_pixelflutsink_adapt_ppp (self, *ppp, *packet_offset, *ppp_count,
+        accepted, (g_get_monotonic_time () - write_start) * GST_USECOND);
+  }
+  *packet_offset = 0;
+  *ppp_count = 0;
+
+  return TRUE;
+}
+
+/* Writes the command drawing @pixel, 0xRRGGBBAA, at @x, @y with the colors
+ * corrected by @lut and returns its length */
+static inline gsize
+gst_pixelflutsink_format_px (gchar *out, gint x, gint y, guint32 pixel,
+    gboolean with_alpha, const GstPixelflutLut *lut)
+{
+  static const gchar digits[] = "0123456789abcdef";
+  gsize len;
+
+  len = g_snprintf (out, PX_MAX_LEN, "PX %d %d ", x, y);
+  gst_pixelflut_lut_format (lut, pixel, out + len);
+  len += 6;
+  if (with_alpha) {
+    out[len++] = digits[(pixel >> 4) & 0xf];
+    out[len++] = digits[pixel & 0xf];
+  }
+  out[len++] = '\n';
+  out[len] = '\0';
+
+  return len;
+}
+
+/* Writes the latency marker of the current frame to @out, which has room
+ * for one more command */
+static gsize
+gst_pixelflutsink_write_marker (GstPixelflutSink *self, gchar *out,
+    guint x, guint y)
+{
+  guint32 count = self->marker_count & MARKER_COUNT_MASK;
+
+  /* not color corrected, the counter is read back from it */
+  return gst_pixelflutsink_format_px (out, x, y, (count << 8) | 0xff, FALSE,
+      gst_pixelflut_lut_get_identity ());
+}
+
+/* Tell the application when the frame with the marker was due and when it
+ * was sent, both in g_get_monotonic_time() microseconds, to compare with
+ * when the marker arrived at the server */
+static void
+gst_pixelflutsink_post_marker (GstPixelflutSink *self, GstClockTime running_time)
+{
+  GstClockTime now = gst_pixelflutsink_get_running_time (self);
+  gint64 sent = g_get_monotonic_time ();
+  gint64 due = sent;
+  GstStructure *s;
+
+  if (GST_CLOCK_TIME_IS_VALID (now) && GST_CLOCK_TIME_IS_VALID (running_time))
+    due -= GST_CLOCK_DIFF (running_time, now) / GST_USECOND;
+
+  s = gst_structure_new ("pixelflut-latency-marker",
+      "counter", G_TYPE_UINT, self->marker_count & MARKER_COUNT_MASK,
+      "running-time", G_TYPE_UINT64, running_time,
+      "due-time", G_TYPE_INT64, due,
+      "sent-time", G_TYPE_INT64, sent, NULL);
+  gst_element_post_message (GST_ELEMENT_CAST (self),
+      gst_message_new_element (GST_OBJECT_CAST (self), s));
+
+  self->marker_count++;
+}
+
+/* A frame to composite, see gst_pixelflutsink_send_layers() */
+typedef struct
+{
+  GstBuffer *buffer;
+  GstVideoInfo info;
+  gint64 left;
+  gint64 top;
+  gint width;
+  gint height;
+  guint zorder;
+  guint index;
+  gboolean mapped;
+  GstVideoFrame frame;
+  GstPixelflutSinkSampler sampler;
+  GstPixelflutSinkKernel kernel;
+} GstPixelflutSinkLayer;
+
+/* What was last sent to a square of the canvas, so that moving a layer
+ * only sends the pixels that actually changed */
+typedef struct
+{
+  /* value of frames_sent when the tile was last drawn */
+  guint64 used;
+  guint32 pixels[TILE_SIZE * TILE_SIZE];
+} GstPixelflutSinkTile;
+
+static gint
+gst_pixelflutsink_layer_compare (gconstpointer a, gconstpointer b)
+{
+  const GstPixelflutSinkLayer *la = a, *lb = b;
+
+  if (la->zorder != lb->zorder)
+    return la->zorder < lb->zorder ? -1 : 1;
+
+  /* keep the order the pads were requested in */
+  return la->index < lb->index ? -1 : (la->index > lb->index);
+}
+
+/* Blends a non-premultiplied source pixel over @dst, both 0xRRGGBBAA */
+static inline guint32
+gst_pixelflutsink_blend (guint32 dst, guint r, guint g, guint b, guint sa)
+{
+  guint da = (dst & 0xff) * (0xff - sa) / 0xff;
+  guint a = sa + da;
+
+  r = (r * sa + ((dst >> 24) & 0xff) * da) / a;
+  g = (g * sa + ((dst >> 16) & 0xff) * da) / a;
+  b = (b * sa + ((dst >> 8) & 0xff) * da) / a;
+
+  return (r << 24) | (g << 16) | (b << 8) | a;
+}
+
+/* Draws a mapped layer into the composite, which holds the tile @rect */
+static void
+gst_pixelflutsink_composite_layer (GstPixelflutSink *self,
+    GstPixelflutSinkLayer *layer, const GstVideoRectangle *rect)
+{
+  guint32 row[TILE_SIZE];
+  gint64 x0, y0, x1, y1, y;
+  gint i, n;
+
+  x0 = MAX (layer->left, rect->x);
+  y0 = MAX (layer->top, rect->y);
+  x1 = MIN (layer->left + layer->width, (gint64) rect->x + rect->w);
+  y1 = MIN (layer->top + layer->height, (gint64) rect->y + rect->h);
+
+  if (x0 >= x1)
+    return;
+  n = x1 - x0;
+
+  for (y = y0; y < y1; y++) {
+    guint32 *dst = self->composite + (y - rect->y) * TILE_SIZE + (x0 - rect->x);
+
+    layer->kernel (&layer->sampler, x0 - layer->left, y - layer->top, 1, n, row);
+
+    for (i = 0; i < n; i++, dst++) {
+      guint32 pixel = row[i];
+      guint alpha = pixel & 0xff;
+
+      if (alpha == 0x00)
+        continue;
+      if (alpha == 0xff)
+        *dst = pixel;
+      else
+        *dst = gst_pixelflutsink_blend (*dst, pixel >> 24, (pixel >> 16) & 0xff,
+            (pixel >> 8) & 0xff, alpha);
+    }
+  }
+}
+
+/* The tile with what was sent to tile column @tx, row @ty, allocated when
+ * a layer first covers it */
+static GstPixelflutSinkTile *
+gst_pixelflutsink_get_tile (GstPixelflutSink *self, guint tx, guint ty)
+{
+  GstPixelflutSinkTile *tile;
+  guint64 key = ((guint64) ty << 32) | tx;
+
+  if (!self->tiles) {
+    self->tiles = g_hash_table_new_full (g_int64_hash, g_int64_equal,
+        g_free, g_free);
+  }
+
+  tile = g_hash_table_lookup (self->tiles, &key);
+  if (!tile) {
+    guint64 *k = g_new (guint64, 1);
+
+    *k = key;
+    tile = g_new0 (GstPixelflutSinkTile, 1);
+    g_hash_table_insert (self->tiles, k, tile);
+  }
+  tile->used = self->frames_sent;
+
+  return tile;
+}
+
+static gboolean
+gst_pixelflutsink_tile_is_stale (gpointer key, gpointer value, gpointer data)
+{
+  const GstPixelflutSinkTile *tile = value;
+
+  return tile->used != *(const guint64 *) data;
+}
+
+/* Forget the tiles not drawn in this frame once there are too many, their
+ * pixels are sent again when a layer covers them the next time */
+static void
+gst_pixelflutsink_trim_tiles (GstPixelflutSink *self)
+{
+  guint64 frame = self->frames_sent;
+
+  if (self->tiles && g_hash_table_size (self->tiles) > TILES_MAX)
+    g_hash_table_foreach_remove (self->tiles, gst_pixelflutsink_tile_is_stale, &frame);
+}
+
+/* Composites the frame of the sink pad and the current frames of all
+ * layers in canvas space and sends each visible canvas pixel once, with
+ * the update strategy only those that changed since the last frame. */
+static GstFlowReturn
+gst_pixelflutsink_send_layers (GstPixelflutSink *self, GstBuffer *buffer)
+{
+  GstBaseSink *bsink = GST_BASE_SINK (self);
+  GArray *layers;
+  GList *pads, *l;
+  GstPixelflutSinkLayer *layer;
+  GstVideoRectangle rect;
+  gint64 x0, y0, x1, y1;
+  gint offset_left, offset_top;
+  guint canvas_w, canvas_h;
+  guint ppp, ppp_count = 0;
+  gboolean auto_ppp, update;
+  gchar *outbuf;
+  gsize packet_offset = 0;
+  gsize frame_written = 0;
+  guint64 frame_pixels = 0;
+  gsize skipped_pixels = 0;
+  gint fragments_count = 0;
+  GstClockTime running_time;
+  gint64 start;
+  GError *err = NULL;
+  const GstPixelflutLut *lut;
+  gboolean marker;
+  guint marker_x, marker_y;
+  GstFlowReturn ret;
+  guint i, tx, ty;
+  gint x, y;
+
+  layers = g_array_new (FALSE, TRUE, sizeof (GstPixelflutSinkLayer));
+
+  GST_OBJECT_LOCK (self);
+  offset_left = self->offset_left;
+  offset_top = self->offset_top;
+  ppp = gst_pixelflutsink_get_ppp_locked (self, &auto_ppp);
+  canvas_w = self->canvas_width;
+  canvas_h = self->canvas_height;
+  update = (self->strategy == GST_PIXELFLUTSINK_STRATEGY_UPDATE);
+  marker = self->latency_marker;
+  marker_x = self->marker_x;
+  marker_y = self->marker_y;
+  running_time = gst_segment_to_running_time (&bsink->segment, GST_FORMAT_TIME,
+      GST_BUFFER_PTS (buffer));
+  pads = g_list_copy_deep (self->layers, (GCopyFunc) gst_object_ref, NULL);
+  g_array_set_size (layers, 1);
+  layer = &g_array_index (layers, GstPixelflutSinkLayer, 0);
+  layer->buffer = gst_buffer_ref (buffer);
+  layer->info = self->info;
+  gst_pixelflutsink_get_draw_size_locked (self, &layer->info, &layer->width,
+      &layer->height);
+  GST_OBJECT_UNLOCK (self);
+
+  /* the sink pad is the bottom layer at offset-left/offset-top */
+  layer->left = offset_left;
+  layer->top = offset_top;
+  layer->zorder = 0;
+  layer->index = 0;
+
+  for (l = pads; l; l = l->next) {
+    GstPixelflutLayerPad *pad = l->data;
+    GstPixelflutSinkLayer entry;
+
+    entry.buffer = gst_pixelflut_layer_pad_get_frame (pad, running_time, &entry.info);
+    if (!entry.buffer)
+      continue;
+
+    GST_OBJECT_LOCK (pad);
+    entry.left = (gint64) offset_left + pad->xpos;
+    entry.top = (gint64) offset_top + pad->ypos;
+    entry.zorder = pad->zorder;
+    GST_OBJECT_UNLOCK (pad);
+    entry.width = GST_VIDEO_INFO_WIDTH (&entry.info);
+    entry.height = GST_VIDEO_INFO_HEIGHT (&entry.info);
+    entry.index = layers->len;
+    entry.mapped = FALSE;
+    g_array_append_val (layers, entry);
+  }
+  g_list_free_full (pads, gst_object_unref);
+
+  g_array_sort (layers, gst_pixelflutsink_layer_compare);
+
+  /* only the part of the canvas covered by any layer is looked at */
+  x0 = canvas_w;
+  y0 = canvas_h;
+  x1 = y1 = 0;
+  for (i = 0; i < layers->len; i++) {
+    gint64 l0, t0, l1, t1;
+
+    layer = &g_array_index (layers, GstPixelflutSinkLayer, i);
+    l0 = CLAMP (layer->left, 0, canvas_w);
+    t0 = CLAMP (layer->top, 0, canvas_h);
+    l1 = CLAMP (layer->left + layer->width, 0, canvas_w);
+    t1 = CLAMP (layer->top + layer->height, 0, canvas_h);
+
+    if (l1 <= l0 || t1 <= t0)
+      continue;
+    x0 = MIN (x0, l0);
+    y0 = MIN (y0, t0);
+    x1 = MAX (x1, l1);
+    y1 = MAX (y1, t1);
+  }
+  rect.x = x0;
+  rect.y = y0;
+  rect.w = MAX (x1 - x0, 0);
+  rect.h = MAX (y1 - y0, 0);
+
+  /* the canvas is composited a tile at a time, with the update strategy
+   * what was sent is kept for the tiles covered by layers */
+  if (!update || self->tiles_width != canvas_w || self->tiles_height != canvas_h) {
+    g_clear_pointer (&self->tiles, g_hash_table_unref);
+    self->tiles_width = canvas_w;
+    self->tiles_height = canvas_h;
+  }
+  if (!self->composite)
+    self->composite = g_new (guint32, TILE_SIZE * TILE_SIZE);
+
+  for (i = 0; i < layers->len; i++) {
+    layer = &g_array_index (layers, GstPixelflutSinkLayer, i);
+    if (!gst_video_frame_map (&layer->frame, &layer->info, layer->buffer, GST_MAP_READ))
+      goto invalid_frame;
+    gst_pixelflutsink_sampler_init (&layer->sampler, &layer->frame, layer->width,
+        layer->height);
+    layer->kernel =
+        gst_pixelflutsink_get_kernel (GST_VIDEO_INFO_FORMAT (&layer->info));
+    layer->mapped = TRUE;
+  }
+
+  if (self->recorder) {
+    gst_pixelflut_recorder_begin_frame (self->recorder, running_time,
+        GST_BUFFER_DURATION (buffer), offset_left, offset_top, canvas_w, canvas_h);
+  }
+
+  start = g_get_monotonic_time ();
+
+#ifdef HAVE_LIBURING
+  if (self->uring && !gst_pixelflutsink_ensure_arena (self, &err))
+    goto write_error;
+#endif
+  outbuf = self->uring ? self->arena :
+      gst_pixelflutsink_ensure_outbuf (self, auto_ppp ? PPP_MAX : ppp);
+  lut = self->lut ? self->lut : gst_pixelflut_lut_get_identity ();
+
+  for (ty = rect.y / TILE_SIZE; rect.h && ty <= (guint) (rect.y + rect.h - 1) / TILE_SIZE; ty++) {
+    for (tx = rect.x / TILE_SIZE; rect.w && tx <= (guint) (rect.x + rect.w - 1) / TILE_SIZE; tx++) {
+      GstVideoRectangle tile_rect;
+      GstPixelflutSinkTile *tile;
+
+      tile_rect.x = MAX (rect.x, (gint64) tx * TILE_SIZE);
+      tile_rect.y = MAX (rect.y, (gint64) ty * TILE_SIZE);
+      tile_rect.w = MIN ((gint64) rect.x + rect.w, ((gint64) tx + 1) * TILE_SIZE) - tile_rect.x;
+      tile_rect.h = MIN ((gint64) rect.y + rect.h, ((gint64) ty + 1) * TILE_SIZE) - tile_rect.y;
+
+      for (y = 0; y < tile_rect.h; y++)
+        memset (self->composite + y * TILE_SIZE, 0, tile_rect.w * sizeof (guint32));
+      for (i = 0; i < layers->len; i++)
+        gst_pixelflutsink_composite_layer (self,
+            &g_array_index (layers, GstPixelflutSinkLayer, i), &tile_rect);
+
+      tile = update ? gst_pixelflutsink_get_tile (self, tx, ty) : NULL;
+
+      for (y = tile_rect.y; y < tile_rect.y + tile_rect.h; y++) {
+        const guint32 *src = self->composite + (y - tile_rect.y) * TILE_SIZE;
+        guint32 *sent = tile ?
+            tile->pixels + (y % TILE_SIZE) * TILE_SIZE + tile_rect.x % TILE_SIZE : NULL;
+        /* the marker pixel belongs to the marker */
+        gint marker_skip = (marker && y == (gint) marker_y) ? (gint) marker_x : -1;
+
+        for (x = tile_rect.x; x < tile_rect.x + tile_rect.w; x++, src++) {
+          guint32 pixel = *src;
+
+          /* nothing to draw here, or already drawn */
+          if ((pixel & 0xff) == 0x00 || (sent && pixel == sent[x - tile_rect.x]) ||
+              G_UNLIKELY (x == marker_skip)) {
+            skipped_pixels++;
+            continue;
+          }
+          if (sent)
+            sent[x - tile_rect.x] = pixel;
+
+          packet_offset += gst_pixelflutsink_format_px (outbuf + packet_offset,
+              x, y, pixel, (pixel & 0xff) != 0xff, lut);
+          ppp_count++;
+          frame_pixels++;
+
+          if (ppp_count >= ppp && !gst_pixelflutsink_flush_packet (self, &outbuf,
+                  &packet_offset, &ppp_count, &ppp, auto_ppp, &fragments_count,
+                  &frame_written, &err))
+            goto write_error;
+        }
+      }
+    }
+  }
+
+  if (marker)
+    packet_offset += gst_pixelflutsink_write_marker (self, outbuf + packet_offset,
+        marker_x, marker_y);
+
+  if (packet_offset) {
+    if (!gst_pixelflutsink_send_packet (self, outbuf,
+            packet_offset, &fragments_count, NULL, &err)) {
+      goto write_error;
+    }
+    frame_written += packet_offset;
+  }
+
+  if (marker)
+    gst_pixelflutsink_post_marker (self, running_time);
+
+  if (self->recorder)
+    gst_pixelflut_recorder_end_frame (self->recorder);
+
+  gst_pixelflutsink_update_render_time (self,
+      (g_get_monotonic_time () - start) * GST_USECOND);
+  gst_pixelflutsink_trim_tiles (self);
+
+  GST_OBJECT_LOCK (self);
+  self->bytes_written += frame_written;
+  self->pixels_sent += frame_pixels;
+  self->frames_sent++;
+  GST_OBJECT_UNLOCK (self);
+
+  GST_LOG_OBJECT (self, "%u layers in (%d,%d) %dx%d composited, %" G_GSIZE_FORMAT
+      " bytes sent in %d fragments, %" G_GSIZE_FORMAT " pixels skipped",
+      layers->len, rect.x, rect.y, rect.w, rect.h, frame_written,
+      fragments_count, skipped_pixels);
+
+  ret = GST_FLOW_OK;
+
+done:
+  for (i = 0; i < layers->len; i++) {
+    layer = &g_array_index (layers, GstPixelflutSinkLayer, i);
+    if (layer->mapped) {
+      gst_pixelflutsink_sampler_clear (&layer->sampler);
+      gst_video_frame_unmap (&layer->frame);
+    }
+    gst_buffer_unref (layer->buffer);
+  }
+  g_array_free (layers, TRUE);
+
+  return ret;
+
+  /* ERRORS */
+invalid_frame:
+  {
+    GST_WARNING_OBJECT (self, "invalid frame in layer %u", i);
+    ret = GST_FLOW_ERROR;
+    goto done;
+  }
+write_error:
+  {
+    if (g_error_matches (err, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+      ret = GST_FLOW_FLUSHING;
+      GST_DEBUG_OBJECT (self, "Cancelled writing to socket");
+    } else {
+      GST_WARNING_OBJECT (self, "Error while sending layers, %" G_GSIZE_FORMAT
+          " bytes of frame written: %s", frame_written, err->message);
+      ret = GST_FLOW_ERROR;
+    }
+    g_clear_error (&err);
+    goto done;
+  }
+}
+
+/* Pixels x_begin, x_begin + step, ... below x_end of row y */
+typedef struct
+{
+  gint y;
+  gint x_begin;
+  gint x_end;
+  gint step;
+} GstPixelflutSinkSpan;
+
+/* Walks the part of a frame on the canvas in the given order */
+typedef struct
+{
+  GstPixelflutSinkOrder order;
+  gint x_begin;
+  gint x_end;
+  gint y_begin;
+  gint y_end;
+  guint pass;
+  /* current row, -1 before the first row of a pass */
+  gint y;
+  /* random order */
+  const guint32 *permutation;
+  gsize index;
+  gsize n;
+  gint width;
+} GstPixelflutSinkCursor;
+
+/* phase and step of the rows of each interlaced pass */
+static const gint interlaced_passes[][2] = { {0, 8}, {4, 8}, {2, 4}, {1, 2} };
+/* grid spacing of each progressive pass */
+static const gint progressive_passes[] = { 8, 4, 2, 1 };
+
+/* The first row or column from @begin on that is @phase modulo @step */
+static inline gint
+gst_pixelflutsink_align (gint begin, gint phase, gint step)
+{
+  return begin + ((phase - begin) % step + step) % step;
+}
+
+static void
+gst_pixelflutsink_cursor_init (GstPixelflutSinkCursor *cursor,
+    GstPixelflutSinkOrder order, gint x_begin, gint x_end, gint y_begin,
+    gint y_end, const guint32 *permutation, gint width, gint height)
+{
+  cursor->order = order;
+  cursor->x_begin = x_begin;
+  cursor->x_end = x_end;
+  cursor->y_begin = y_begin;
+  cursor->y_end = y_end;
+  cursor->pass = 0;
+  cursor->y = -1;
+  cursor->permutation = permutation;
+  cursor->index = 0;
+  cursor->n = permutation ? (gsize) width * height : 0;
+  cursor->width = width;
+}
+
+static gboolean
+gst_pixelflutsink_cursor_next (GstPixelflutSinkCursor *cursor,
+    GstPixelflutSinkSpan *span)
+{
+  if (cursor->x_begin >= cursor->x_end)
+    return FALSE;
+
+  span->x_end = cursor->x_end;
+
+  switch (cursor->order) {
+    case GST_PIXELFLUTSINK_ORDER_RASTER:
+      cursor->y = cursor->y < 0 ? cursor->y_begin : cursor->y + 1;
+      if (cursor->y >= cursor->y_end)
+        return FALSE;
+      span->y = cursor->y;
+      span->x_begin = cursor->x_begin;
+      span->step = 1;
+      return TRUE;
+    case GST_PIXELFLUTSINK_ORDER_INTERLACED:
+      while (cursor->pass < G_N_ELEMENTS (interlaced_passes)) {
+        gint phase = interlaced_passes[cursor->pass][0];
+        gint step = interlaced_passes[cursor->pass][1];
+
+        cursor->y = cursor->y < 0 ?
+            gst_pixelflutsink_align (cursor->y_begin, phase, step) : cursor->y + step;
+        if (cursor->y < cursor->y_end) {
+          span->y = cursor->y;
+          span->x_begin = cursor->x_begin;
+          span->step = 1;
+          return TRUE;
+        }
+        cursor->pass++;
+        cursor->y = -1;
+      }
+      return FALSE;
+    case GST_PIXELFLUTSINK_ORDER_PROGRESSIVE:
+      while (cursor->pass < G_N_ELEMENTS (progressive_passes)) {
+        gint step = progressive_passes[cursor->pass];
+
+        cursor->y = cursor->y < 0 ?
+            gst_pixelflutsink_align (cursor->y_begin, 0, step) : cursor->y + step;
+        if (cursor->y < cursor->y_end) {
+          span->y = cursor->y;
+          /* every other point of the rows of the coarser grid was sent */
+          if (cursor->pass > 0 && cursor->y % (2 * step) == 0) {
+            span->x_begin = gst_pixelflutsink_align (cursor->x_begin, step, 2 * step);
+            span->step = 2 * step;
+          } else {
+            span->x_begin = gst_pixelflutsink_align (cursor->x_begin, 0, step);
+            span->step = step;
+          }
+          return TRUE;
+        }
+        cursor->pass++;
+        cursor->y = -1;
+      }
+      return FALSE;
+    case GST_PIXELFLUTSINK_ORDER_RANDOM:
+      while (cursor->index < cursor->n) {
+        guint32 i = cursor->permutation[cursor->index++];
+        gint x = i % cursor->width, y = i / cursor->width;
+
+        if (x >= cursor->x_begin && x < cursor->x_end &&
+            y >= cursor->y_begin && y < cursor->y_end) {
+          span->y = y;
+          span->x_begin = x;
+          span->x_end = x + 1;
+          span->step = 1;
+          return TRUE;
+        }
+      }
+      return FALSE;
+  }
+
+  return FALSE;
+}
+
+/* The shuffled pixel indices of a @width x @height frame, or NULL if the
+ * frame is too large to index with 32 bits */
+static const guint32 *
+gst_pixelflutsink_get_permutation (GstPixelflutSink *self, gint width, gint height)
+{
+  gsize n = (gsize) width * height, i;
+  GRand *rand;
+
+  if (self->permutation && self->permutation_width == width &&
+      self->permutation_height == height)
+    return self->permutation;
+
+  g_clear_pointer (&self->permutation, g_free);
+  self->permutation_width = 0;
+  self->permutation_height = 0;
+  if (n == 0 || n > G_MAXUINT32)
+    return NULL;
+
+  self->permutation = g_new (guint32, n);
+  for (i = 0; i < n; i++)
+    self->permutation[i] = i;
+
+  /* Fisher-Yates */
+  rand = g_rand_new_with_seed (PERMUTATION_SEED);
+  for (i = n - 1; i > 0; i--) {
+    guint64 r = ((guint64) g_rand_int (rand) << 32) | g_rand_int (rand);
+    gsize j = r % (i + 1);
+    guint32 tmp = self->permutation[i];
+
+    self->permutation[i] = self->permutation[j];
+    self->permutation[j] = tmp;
+  }
+  g_rand_free (rand);
+
+  self->permutation_width = width;
+  self->permutation_height = height;
+
+  return self->permutation;
+}
+
+static GstFlowReturn
+gst_pixelflutsink_send_frame (GstVideoSink * vsink, GstBuffer * buffer)
+{
+  GstPixelflutSink *self = GST_PIXELFLUTSINK (vsink);
+  GstBaseSink *bsink = GST_BASE_SINK (vsink);
   GstVideoInfo info;
   GstVideoFrame frame;
+  GstPixelflutSinkSampler sampler, prev_sampler;
   gint offset_left, offset_top;
   guint canvas_w, canvas_h;
-  guint8 *data;
-  gint offsets[3];   // offsets of color bytes in the pixel
-  gint height, width;// frame dimensions
-  gint plane_stride; // number of bytes per row
-  gint pixel_stride; // number of bytes per pixel
+  gint height, width;// size the frame is drawn at
   gint x, y;         // coordinate iterators
-  gint row_wrap;     // to skip padding bytes in rows
+  gint x_begin, x_end, y_begin, y_end; // part of the frame on the canvas
+  GstPixelflutSinkOrder order;     // in which order to walk the frame
+  GstPixelflutSinkCursor cursor;
+  GstPixelflutSinkSpan span;
+  const guint32 *permutation = NULL;
+  GstPixelflutSinkKernel kernel;    // converts the pixels of a span
+  gint *row_bounds = NULL;          // opaque part of each row
+  guint64 visited = 0, total;       // pixels looked at, for pacing
   gboolean has_alpha;// whether frame has alpha plane
-  gchar alpha_str[3];// optional suffix for transparency
+  gboolean use_prev; // only send pixels changed since prev_buffer
+  gint prev_left, prev_top, prev_width, prev_height; // previous placement
+  gint64 dx, dy;     // shift from the previous placement
+  gboolean erase, bg_alpha; // draw the background where nothing is now
+  guint32 bg_pixel;
   guint ppp, ppp_count = 0; // pixels per packet
+  gboolean auto_ppp;        // adapt ppp to the socket
+  gchar *outbuf;            // to assemble the pixeflut command
   gsize packet_offset = 0;  // for fragmented sending
   GError *err = NULL;
   gboolean is_open;
-  GOutputStream *ostream;
   gint fragments_count = 0;
-  gssize fragment_written = 0;
   gsize frame_written = 0;
+  guint64 frame_pixels = 0;
   gsize skipped_pixels = 0;
   GstVideoFrame prev_frame;
+  gboolean pacing, cut_off;
+  GstClockTime running_time, duration, deadline;
+  GstClockTime start, waited = 0;
+  gboolean cut = FALSE;
+  GstClockTime connect_timeout;
+  gboolean has_layers;
+  const GstPixelflutLut *lut;
+  gboolean marker;
+  guint marker_x, marker_y;
+  GstFlowReturn ret;
+
+  GST_OBJECT_LOCK (self);
+  is_open = self->is_open;
+  connect_timeout = self->connect_timeout;
+  has_layers = (self->layers != NULL);
+  GST_OBJECT_UNLOCK (self);
+
+  g_return_val_if_fail (is_open, GST_FLOW_FLUSHING);
+
+  ret = gst_pixelflutsink_ensure_connection (self, connect_timeout);
+  if (ret != GST_FLOW_OK)
+    return ret;
+
+  if (self->passthrough)
+    return gst_pixelflutsink_send_commands (self, buffer);
+  if (has_layers)
+    return gst_pixelflutsink_send_layers (self, buffer);
 
   GST_OBJECT_LOCK (self);
   offset_left = self->offset_left;
   offset_top = self->offset_top;
   info = self->info;
-  is_open = self->is_open;
-  ostream = self->ostream;
-  ppp = self->pixels_per_packet;
+  kernel = self->kernel;
+  ppp = gst_pixelflutsink_get_ppp_locked (self, &auto_ppp);
+  gst_pixelflutsink_get_draw_size_locked (self, &info, &width, &height);
   canvas_w = self->canvas_width;
   canvas_h = self->canvas_height;
+  pacing = self->pacing;
+  cut_off = self->cut_off;
+  order = self->order;
+  marker = self->latency_marker;
+  marker_x = self->marker_x;
+  marker_y = self->marker_y;
+  prev_left = self->prev_left;
+  prev_top = self->prev_top;
+  prev_width = self->prev_width;
+  prev_height = self->prev_height;
+  bg_pixel = (self->background << 8) | (self->background >> 24);
+  running_time = gst_segment_to_running_time (&bsink->segment, GST_FORMAT_TIME,
+      GST_BUFFER_PTS (buffer));
   GST_OBJECT_UNLOCK (self);
 
-  gchar outbuf[22*ppp+1];  // to assemble the pixeflut command
+  erase = (bg_pixel & 0xff) != 0x00;
+  bg_alpha = (bg_pixel & 0xff) != 0xff;
+  dx = (gint64) offset_left - prev_left;
+  dy = (gint64) offset_top - prev_top;
 
-  g_return_val_if_fail (is_open, GST_FLOW_FLUSHING);
+  duration = GST_BUFFER_DURATION (buffer);
+  if (!GST_CLOCK_TIME_IS_VALID (duration) && info.fps_n > 0)
+    duration = gst_util_uint64_scale_int (GST_SECOND, info.fps_d, info.fps_n);
 
-  if (GST_IS_BUFFER(self->prev_buffer) && self->strategy == GST_PIXELFLUTSINK_STRATEGY_UPDATE) {
-  if (!gst_video_frame_map (&prev_frame, &info, self->prev_buffer, GST_MAP_READ))
-    goto invalid_frame;
+  /* pacing and cut-off both need a position on the clock to aim for */
+  if (!GST_CLOCK_TIME_IS_VALID (running_time) || !GST_CLOCK_TIME_IS_VALID (duration)) {
+    pacing = cut_off = FALSE;
+  }
+  pacing = pacing && gst_base_sink_get_sync (bsink);
+  deadline = cut_off ? running_time + duration : GST_CLOCK_TIME_NONE;
+
+  if (self->recorder) {
+    gst_pixelflut_recorder_begin_frame (self->recorder, running_time, duration,
+        offset_left, offset_top, canvas_w, canvas_h);
+  }
+
+  start = g_get_monotonic_time ();
+
+  /* the previous frame is compared where it was on the canvas, so moving
+   * the frame only sends what changes along edges */
+  use_prev = GST_IS_BUFFER (self->prev_buffer) && prev_width > 0 &&
+      self->strategy == GST_PIXELFLUTSINK_STRATEGY_UPDATE;
+  if (use_prev) {
+    if (!gst_video_frame_map (&prev_frame, &info, self->prev_buffer, GST_MAP_READ))
+      goto invalid_frame;
+    gst_pixelflutsink_sampler_init (&prev_sampler, &prev_frame, prev_width, prev_height);
   }
 
   /* Fill GstVideoFrame structure so that pixel data can accessed */
-  if (!gst_video_frame_map (&frame, &info, buffer, GST_MAP_READ))
+  if (!gst_video_frame_map (&frame, &info, buffer, GST_MAP_READ)) {
+    if (use_prev)
+      gst_pixelflutsink_unmap_prev (&prev_frame, &prev_sampler);
     goto invalid_frame;
+  }
 
-  has_alpha = GST_VIDEO_FORMAT_INFO_HAS_ALPHA (self->info.finfo);
+  /* converting and scaling happens per pixel sent */
+  gst_pixelflutsink_sampler_init (&sampler, &frame, width, height);
 
-  data = (guint8 *) GST_VIDEO_FRAME_PLANE_DATA (&frame, 0);
+#ifdef HAVE_LIBURING
+  if (self->uring && !gst_pixelflutsink_ensure_arena (self, &err))
+    goto write_error;
+#endif
+  outbuf = self->uring ? self->arena :
+      gst_pixelflutsink_ensure_outbuf (self, auto_ppp ? PPP_MAX : ppp);
+
+  has_alpha = GST_VIDEO_INFO_HAS_ALPHA (&info);
+  lut = self->lut ? self->lut : gst_pixelflut_lut_get_identity ();
+
+  /* in 64 bits, offsets and canvas size may each be close to G_MAXINT */
+  x_begin = CLAMP (-(gint64) offset_left, 0, width);
+  x_end = CLAMP ((gint64) canvas_w - offset_left, x_begin, width);
+  y_begin = CLAMP (-(gint64) offset_top, 0, height);
+  y_end = CLAMP ((gint64) canvas_h - offset_top, y_begin, height);
+  total = (guint64) (x_end - x_begin) * (y_end - y_begin);
+
+  if (order == GST_PIXELFLUTSINK_ORDER_RANDOM) {
+    permutation = gst_pixelflutsink_get_permutation (self, width, height);
+    if (!permutation) {
+      GST_WARNING_OBJECT (self, "%dx%d too large to shuffle, sending progressively",
+          width, height);
+      order = GST_PIXELFLUTSINK_ORDER_PROGRESSIVE;
+    }
+  }
+  gst_pixelflutsink_cursor_init (&cursor, order, x_begin, x_end, y_begin, y_end,
+      permutation, width, height);
+
+  /* unless transparent pixels have to be erased, only the opaque part of
+   * each row is looked at and transparent runs in it are skipped whole,
+   * so sparse overlays cost what their opaque area does */
+  if (!erase && gst_pixelflutsink_sampler_can_scan_alpha (&sampler)) {
+    row_bounds = g_new (gint, 2 * height);
+    gst_pixelflutsink_get_row_bounds (&sampler, width, y_begin, y_end, row_bounds);
+  }
 
-  plane_stride = GST_VIDEO_FRAME_PLANE_STRIDE (&frame, 0);
-  width = GST_VIDEO_FRAME_COMP_WIDTH (&frame, 0);
-  height = GST_VIDEO_FRAME_COMP_HEIGHT (&frame, 0);
-  pixel_stride = GST_VIDEO_FRAME_COMP_PSTRIDE (&frame, 0);
+  if (1) { // strategy line_by_line
+    while (gst_pixelflutsink_cursor_next (&cursor, &span)) {
+      gint marker_skip;
+      gint span_begin = span.x_begin, span_end = span.x_end;
+      const guint8 *alpha_row = NULL;
+
+      y = span.y;
+      /* the marker pixel belongs to the marker */
+      marker_skip = (marker && y+offset_top == (gint) marker_y) ?
+          (gint) marker_x - offset_left : -1;
+
+      if (row_bounds) {
+        span_begin += span.step * gst_pixelflutsink_span_count (span.x_begin,
+            row_bounds[2 * y], span.step);
+        span_end = MIN (span.x_end, row_bounds[2 * y + 1]);
+        /* what lies outside counts as looked at */
+        visited += gst_pixelflutsink_span_count (span.x_begin, span.x_end, span.step) -
+            gst_pixelflutsink_span_count (span_begin, span_end, span.step);
+        alpha_row = sampler.planes[0] + sampler.ymap[y] * sampler.strides[0];
+      }
 
-  offsets[0] = GST_VIDEO_FRAME_COMP_OFFSET (&frame, 0);
-  offsets[1] = GST_VIDEO_FRAME_COMP_OFFSET (&frame, 1);
-  offsets[2] = GST_VIDEO_FRAME_COMP_OFFSET (&frame, 2);
-  if (has_alpha) {
-    offsets[3] = GST_VIDEO_FRAME_COMP_OFFSET (&frame, 3);
-  }
+      /* the span is converted a chunk at a time, with the previous frame
+       * where it was on the canvas */
+      x = span_begin;
+      while (x < span_end) {
+        guint32 pixels[SPAN_CHUNK], prevs[SPAN_CHUNK];
+        gint64 py = y + dy, first;
+        gint n, i, p_begin = 0, p_end = 0; // chunk entries the previous frame drew
+
+        if (alpha_row) {
+          /* skip a run of fully transparent pixels whole, scanning no
+           * further than the span reaches */
+          guint next = gst_pixelflutsink_alpha_scan (alpha_row, sampler.offsets[3],
+              sampler.xmap[x], sampler.xmap[span_end - 1] + 1);
+          gint skip = gst_pixelflutsink_span_count (x,
+              MIN (span_end, gst_pixelflutsink_sampler_column (&sampler, width,
+                      next)), span.step);
+
+          x += skip * span.step;
+          visited += skip;
+          if (x >= span_end)
+            break;
+        }
+
+        n = MIN (SPAN_CHUNK, gst_pixelflutsink_span_count (x, span_end, span.step));
+        kernel (&sampler, x, y, span.step, n, pixels);
+
+        first = x + dx;
+        if (prev_width > 0 && py >= 0 && py < prev_height) {
+          p_begin = first >= 0 ? 0 : MIN (n, (-first + span.step - 1) / span.step);
+          p_end = MIN (n, MAX ((gint64) prev_width - first + span.step - 1, 0) / span.step);
+          p_end = MAX (p_begin, p_end);
+          if (use_prev && p_end > p_begin)
+            kernel (&prev_sampler, first + p_begin * span.step, py, span.step,
+                p_end - p_begin, prevs + p_begin);
+        }
 
-  row_wrap = plane_stride - pixel_stride * width;
+        for (i = 0; i < n; i++, x += span.step, visited++) {
+          guint32 pixel = pixels[i], prev = 0;
+          gboolean covered = FALSE; // the previous frame drew here
+          gboolean with_alpha = has_alpha;
 
-  if (1) { // strategy line_by_line
-    for (y = 0; (y < height && y+offset_top <= canvas_h); y++) {
-      for (x = 0; (x < width && x+offset_left <= canvas_w); x++) {
-        if (has_alpha) {
-          guint8 val = data[offsets[3]];
-          if (val == 0x00) {
+          if (G_UNLIKELY (x == marker_skip))
+            continue;
+          if ((pixel & 0xff) == 0x00 && !erase) {
             /* skip fully transparent pixel */
-            data += pixel_stride;
             continue;
           }
-          g_snprintf (alpha_str, 3, "%02x", val);
-        }
-        if (GST_IS_BUFFER(self->prev_buffer) && self->strategy == GST_PIXELFLUTSINK_STRATEGY_UPDATE) {
-          guint8 *prev_data = (guint8 *) GST_VIDEO_FRAME_PLANE_DATA (&prev_frame, 0);
-          if (data[offsets[0]] == prev_data[offsets[0]] &&
-              data[offsets[1]] == prev_data[offsets[1]] &&
-              data[offsets[2]] == prev_data[offsets[2]])
-              {
-                /* skip unchanged pixel */
-                data += pixel_stride;
-                skipped_pixels += 1;
-                continue;
-              }
-        }
 
-        g_snprintf (outbuf+packet_offset, 22,
-                    "PX %d %d %02x%02x%02x%s\n",
-                    x+offset_left, y+offset_top,
-                    data[offsets[0]],
-                    data[offsets[1]],
-                    data[offsets[2]],
-                    has_alpha ? alpha_str : "");
-
-        packet_offset = strlen(outbuf);
-
-        if (ppp_count && ppp_count % ppp == 0) {
-          fragment_written = 0;
-          while (fragment_written < packet_offset) {
-            gssize wret;
-            fragments_count++;
-            wret =
-              g_output_stream_write (ostream, outbuf + fragment_written,
-              packet_offset - fragment_written, self->cancellable, &err);
-            if (wret < 0) {
+          if (i >= p_begin && i < p_end) {
+            if (use_prev)
+              prev = prevs[i];
+            covered = !use_prev || (prev & 0xff) != 0x00;
+          }
+
+          if ((pixel & 0xff) == 0x00) {
+            /* fully transparent, erase what the previous frame drew here */
+            if (!covered)
+              continue;
+            pixel = bg_pixel;
+            with_alpha = bg_alpha;
+          }
+          if (use_prev && covered && (pixel >> 8) == (prev >> 8)) {
+            /* skip unchanged pixel */
+            skipped_pixels += 1;
+            continue;
+          }
+
+          packet_offset += gst_pixelflutsink_format_px (outbuf+packet_offset,
+              x+offset_left, y+offset_top, pixel, with_alpha, lut);
+          ppp_count++;
+          frame_pixels++;
+
+          if (ppp_count >= ppp) {
+            if (!gst_pixelflutsink_flush_packet (self, &outbuf, &packet_offset,
+                    &ppp_count, &ppp, auto_ppp, &fragments_count, &frame_written, &err))
               goto write_error;
+
+            if (pacing) {
+              /* aim at the share of the frame duration this packet covers */
+              GstClockTime target = running_time +
+                  gst_util_uint64_scale (duration, visited, total);
+              gint64 wait_start = g_get_monotonic_time ();
+              GstClockReturn cret = gst_base_sink_wait_clock (bsink, target, NULL);
+
+              waited += (g_get_monotonic_time () - wait_start) * GST_USECOND;
+              if (cret == GST_CLOCK_UNSCHEDULED)
+                goto flushing;
             }
-            fragment_written += wret;
-            if (gst_debug_category_get_threshold (pixelflutsink_debug) >= GST_LEVEL_MEMDUMP) {
-              GST_TRACE_OBJECT (self, "sent: %s", outbuf);
+
+            if (cut_off) {
+              GstClockTime now = gst_pixelflutsink_get_running_time (self);
+              if (GST_CLOCK_TIME_IS_VALID (now) && now > deadline) {
+                GST_DEBUG_OBJECT (self, "deadline passed at (%d,%d), cutting off frame",
+                    x, y);
+                cut = TRUE;
+                gst_pixelflutsink_post_qos (self, buffer, running_time,
+                    GST_CLOCK_DIFF (deadline, now));
+                goto frame_done;
+              }
             }
-            GST_TRACE_OBJECT (self, "sent: wret=%" G_GSSIZE_FORMAT " fragment_written=%"
-                              G_GSSIZE_FORMAT " frame_written=%" G_GSIZE_FORMAT " fragments_count=%d",
-                              wret, fragment_written, frame_written, fragments_count);
-            packet_offset = 0;
-            ppp_count = 0;
           }
-          frame_written += fragment_written;
         }
+      }
+    }
+  }
+
+  /* erase what the previous frame covered outside of this one */
+  if (erase && prev_width > 0 && (dx || dy || width != prev_width || height != prev_height)) {
+    gint64 ex_begin = MAX (prev_left, 0);
+    gint64 ex_end = MIN ((gint64) prev_left + prev_width, (gint64) canvas_w);
+    gint64 ey_begin = MAX (prev_top, 0);
+    gint64 ey_end = MIN ((gint64) prev_top + prev_height, (gint64) canvas_h);
+    gint64 cx, cy;
+
+    for (cy = ey_begin; cy < ey_end; cy++) {
+      gboolean in_frame_rows = cy >= offset_top && cy < (gint64) offset_top + height;
+
+      for (cx = ex_begin; cx < ex_end; cx++) {
+        if (in_frame_rows && cx >= offset_left && cx < (gint64) offset_left + width) {
+          /* drawn above */
+          cx = (gint64) offset_left + width - 1;
+          continue;
+        }
+        if (marker && cx == marker_x && cy == marker_y)
+          continue;
+        if (use_prev && (gst_pixelflutsink_sample (&prev_sampler,
+                    cx - prev_left, cy - prev_top) & 0xff) == 0x00)
+          continue;
+
+        packet_offset += gst_pixelflutsink_format_px (outbuf+packet_offset,
+            cx, cy, bg_pixel, bg_alpha, lut);
         ppp_count++;
-        data += pixel_stride;
+        frame_pixels++;
+
+        if (ppp_count >= ppp && !gst_pixelflutsink_flush_packet (self, &outbuf,
+                &packet_offset, &ppp_count, &ppp, auto_ppp, &fragments_count,
+                &frame_written, &err))
+          goto write_error;
       }
-      data += row_wrap;
     }
   }
 
-  gst_video_frame_unmap (&frame);
-  if (self->strategy == GST_PIXELFLUTSINK_STRATEGY_UPDATE) {
-    if (!GST_IS_BUFFER(self->prev_buffer))
-      self->prev_buffer = gst_buffer_new_allocate (NULL, gst_buffer_get_size (buffer), 0);
+  /* the marker goes last, when it arrives the whole frame has */
+  if (marker)
+    packet_offset += gst_pixelflutsink_write_marker (self, outbuf+packet_offset,
+        marker_x, marker_y);
+
+  /* send what is left of the last packet */
+  if (packet_offset) {
+    if (!gst_pixelflutsink_send_packet (self, outbuf,
+            packet_offset, &fragments_count, NULL, &err)) {
+      goto write_error;
+    }
+    frame_written += packet_offset;
   }
 
+  if (marker)
+    gst_pixelflutsink_post_marker (self, running_time);
+
+frame_done:
+  g_free (row_bounds);
+  gst_pixelflutsink_sampler_clear (&sampler);
+  gst_video_frame_unmap (&frame);
+  if (use_prev)
+    gst_pixelflutsink_unmap_prev (&prev_frame, &prev_sampler);
+  if (self->recorder)
+    gst_pixelflut_recorder_end_frame (self->recorder);
+  /* what the server shows now, unless the frame was cut short */
+  if (self->strategy == GST_PIXELFLUTSINK_STRATEGY_UPDATE)
+    gst_buffer_replace (&self->prev_buffer, cut ? NULL : buffer);
+
+  gst_pixelflutsink_update_render_time (self,
+      (g_get_monotonic_time () - start) * GST_USECOND - waited);
+
   GST_OBJECT_LOCK (self);
   self->bytes_written += frame_written;
+  self->pixels_sent += frame_pixels;
   self->frames_sent++;
+  if (cut)
+    self->frames_cut++;
+  /* where the frame was drawn, even partly, for the next one to diff
+   * against and erase */
+  self->prev_left = offset_left;
+  self->prev_top = offset_top;
+  self->prev_width = width;
+  self->prev_height = height;
   GST_OBJECT_UNLOCK (self);
 
   GST_LOG_OBJECT (self, "frame finished. %" G_GSIZE_FORMAT " bytes sent in %d fragments. "
@@ -692,27 +3348,34 @@ invalid_frame:
     GST_WARNING_OBJECT (self, "invalid frame");
     return GST_FLOW_ERROR;
   }
+flushing:
+  {
+    GST_DEBUG_OBJECT (self, "flushing while pacing frame");
+    g_free (row_bounds);
+    gst_pixelflutsink_sampler_clear (&sampler);
+    gst_video_frame_unmap (&frame);
+    if (use_prev)
+      gst_pixelflutsink_unmap_prev (&prev_frame, &prev_sampler);
+    gst_clear_buffer (&self->prev_buffer);
+    return GST_FLOW_FLUSHING;
+  }
 write_error:
   {
-    GstFlowReturn ret;
-
     if (g_error_matches (err, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
       ret = GST_FLOW_FLUSHING;
       GST_DEBUG_OBJECT (self, "Cancelled writing to socket");
-    } else if (g_error_matches (err, G_IO_ERROR, G_IO_ERROR_CONNECTION_CLOSED)) {
-      GST_INFO_OBJECT (self, "connection closed, re-establishing!");
-      if (gst_pixelflutsink_establish_connection (self)) {
-        ret = GST_FLOW_OK;
-      } else {
-        ret = GST_FLOW_ERROR;
-      }
-    }  else {
-      GST_WARNING_OBJECT (self, "Error while sending data. framents=%d Only %"
-              G_GSIZE_FORMAT " of %" G_GSIZE_FORMAT " bytes written: %s",
-              fragments_count, fragment_written, strlen(outbuf), err->message);
+    } else {
+      GST_WARNING_OBJECT (self, "Error while sending data. framents=%d %"
+              G_GSIZE_FORMAT " bytes of frame written: %s",
+              fragments_count, frame_written, err->message);
       ret = GST_FLOW_ERROR;
     }
+    g_free (row_bounds);
+    gst_pixelflutsink_sampler_clear (&sampler);
     gst_video_frame_unmap (&frame);
+    if (use_prev)
+      gst_pixelflutsink_unmap_prev (&prev_frame, &prev_sampler);
+    gst_clear_buffer (&self->prev_buffer);
     g_clear_error (&err);
     return ret;
   }
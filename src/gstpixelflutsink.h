@@ -26,6 +26,12 @@
 #include <gst/video/video.h>
 #include <gst/video/gstvideosink.h>
 
+#include "gstpixelflutpool.h"
+#include "gstpixelfluturing.h"
+#include "gstpixelflutrecord.h"
+#include "gstpixelflutlayerpad.h"
+#include "gstpixelflutlut.h"
+
 G_BEGIN_DECLS
 
 #define GST_TYPE_PIXELFLUTSINK gst_pixelflutsink_get_type ()
@@ -37,6 +43,27 @@ typedef enum
   GST_PIXELFLUTSINK_STRATEGY_UPDATE
 } GstPixelflutSinkStrategy;
 
+typedef enum
+{
+  GST_PIXELFLUTSINK_ORDER_RASTER,
+  GST_PIXELFLUTSINK_ORDER_INTERLACED,
+  GST_PIXELFLUTSINK_ORDER_PROGRESSIVE,
+  GST_PIXELFLUTSINK_ORDER_RANDOM
+} GstPixelflutSinkOrder;
+
+typedef enum
+{
+  GST_PIXELFLUTSINK_TRANSPORT_TCP,
+  GST_PIXELFLUTSINK_TRANSPORT_UDP
+} GstPixelflutSinkTransport;
+
+typedef struct _GstPixelflutSinkSampler GstPixelflutSinkSampler;
+
+/* Converts @n pixels of row @y, columns @x, @x + @step, ..., to
+ * 0xRRGGBBAA, with the component layout of one video format built in */
+typedef void (*GstPixelflutSinkKernel) (const GstPixelflutSinkSampler *s,
+    gint x, gint y, gint step, gint n, guint32 *out);
+
 /**
  * GstPixelflutSink:
  *
@@ -46,31 +73,112 @@ struct _GstPixelflutSink
 {
   GstVideoSink parent;
 
-  /* video information */
+  /* video information and the kernel converting its pixels */
   GstVideoInfo info;
+  GstPixelflutSinkKernel kernel;
+  /* buffers hold ready made commands, e.g. from pixelflutreplaysrc */
+  gboolean passthrough;
 
   gint offset_top;
   gint offset_left;
+  /* size to draw the frames at, 0 follows the frame */
+  guint scale_width;
+  guint scale_height;
   guint canvas_width;
   guint canvas_height;
 
   /* metrics */
-  size_t bytes_written;
-  gint frames_sent;
+  guint64 bytes_written;
+  guint64 pixels_sent;
+  guint64 frames_sent;
+  guint64 frames_cut;
 
   /* server information */
   int port;
   gchar *host;
 
   /* socket */
-  GSocketConnection *connection;
-  GOutputStream *ostream;
+  GstPixelflutPool *pool;
+  GstPixelflutConnection *conn;
+  guint standby_connections;
+  GstClockTime connect_timeout;
+  gchar *bind_addresses;
+  /* with a shared pool every packet is sent on a leased connection */
+  gboolean shared_pool;
+  GstContext *pool_context;
+  gboolean leasing;
+  guint64 reconnects;
   GCancellable *cancellable;
   gboolean is_open;
+
+  /* datagram transport, the canvas size is still queried via TCP */
+  GstPixelflutSinkTransport transport;
+  guint mtu;
+  GSocket *udp_socket;
+  guint64 datagrams_sent;
+  guint64 datagrams_dropped;
+
+  /* io_uring sender, the arena being filled replaces outbuf */
+  gboolean io_uring;
+  GstPixelflutUring *uring;
+  gchar *arena;
+
   guint pixels_per_packet;
 
+  /* batching, current_ppp is adapted to the socket when ppp is 0 */
+  guint current_ppp;
+  gsize avg_accepted;
+  gchar *outbuf;
+  gsize outbuf_size;
+
   GstPixelflutSinkStrategy strategy;
   GstBuffer *prev_buffer;
+  /* where the previous frame was drawn on the canvas, prev_width is 0
+   * before the first frame */
+  gint prev_left;
+  gint prev_top;
+  gint prev_width;
+  gint prev_height;
+  /* 0xAARRGGBB for canvas pixels no longer covered, none with alpha 0 */
+  guint background;
+
+  /* in which order the pixels of a frame are sent, with the shuffled
+   * pixel indices of a permutation_width x permutation_height frame for
+   * the random order */
+  GstPixelflutSinkOrder order;
+  guint32 *permutation;
+  gint permutation_width;
+  gint permutation_height;
+
+  gchar *record_location;
+  GstPixelflutRecorder *recorder;
+
+  /* color correction while encoding, loaded on start */
+  gchar *color_lut;
+  GstPixelflutLut *lut;
+
+  /* request pads composited over the sink pad, in canvas coordinates
+   * with one RGBA value per pixel, a tile at a time */
+  GList *layers;
+  guint next_layer;
+  guint32 *composite;
+  /* what was sent to the tiles of a canvas of tiles_width x tiles_height */
+  GHashTable *tiles;
+  guint tiles_width;
+  guint tiles_height;
+
+  /* frame pacing */
+  gboolean pacing;
+  gboolean cut_off;
+  GstClockTime avg_render_time;
+
+  /* latency measurement, a pixel at marker_x, marker_y in canvas
+   * coordinates is drawn last in each frame with the frame counter as
+   * its color */
+  gboolean latency_marker;
+  guint marker_x;
+  guint marker_y;
+  guint32 marker_count;
 };
 
 G_END_DECLS
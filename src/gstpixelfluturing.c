@@ -0,0 +1,477 @@
+/*
+ * GStreamer Pixelflut
+ * Copyright 2018 Andreas Frisch <fraxinas@schaffenburg.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <liburing.h>
+
+#include "gstpixelfluturing.h"
+
+GST_DEBUG_CATEGORY_STATIC (pixelfluturing_debug);
+#define GST_CAT_DEFAULT pixelfluturing_debug
+
+/* how long to block for completions before checking for cancellation */
+#define WAIT_INTERVAL (50 * G_TIME_SPAN_MILLISECOND)
+/* how long to wait for the kernel to give back the arenas on free and
+ * reset */
+#define FREE_TIMEOUT G_TIME_SPAN_SECOND
+/* how long to wait for a server that doesn't read to take what is queued */
+#define DRAIN_TIMEOUT (5 * G_TIME_SPAN_SECOND)
+/* user_data of the POLLOUT request in front of a retried chain */
+#define POLL_USER_DATA G_MAXUINT64
+
+typedef enum
+{
+  ARENA_FREE,
+  ARENA_FILLING,   /* handed out to be filled */
+  ARENA_QUEUED,    /* waiting for the previous chain to complete */
+  ARENA_SENDING,   /* submitted to the kernel */
+  ARENA_NOTIF      /* sent, but the kernel still references the pages */
+} GstPixelflutArenaState;
+
+typedef struct
+{
+  gchar *data;
+  gsize len;
+  gsize sent;          /* bytes of len the socket took so far */
+  gint fd;
+  guint64 seq;
+  guint notifs;        /* zero-copy notifications still to come */
+  gboolean dropped;    /* given up on by a reset, not to be retried */
+  GstPixelflutArenaState state;
+} GstPixelflutArena;
+
+struct _GstPixelflutUring
+{
+  struct io_uring ring;
+  gchar *memory;
+  GstPixelflutArena *arenas;
+  guint n_arenas;
+  gsize arena_size;
+  gboolean fixed;      /* arenas are registered buffers */
+  gboolean zerocopy;   /* kernel supports IORING_OP_SEND_ZC */
+
+  GQueue queued;       /* arena indices in send order */
+  guint64 seq;
+  guint sending;
+  gboolean need_poll;  /* socket was full, wait for POLLOUT first */
+  GError *error;
+};
+
+static gint
+gst_pixelflut_uring_compare_seq (gconstpointer a, gconstpointer b, gpointer data)
+{
+  GstPixelflutUring *uring = data;
+  guint64 seq_a = uring->arenas[GPOINTER_TO_UINT (a)].seq;
+  guint64 seq_b = uring->arenas[GPOINTER_TO_UINT (b)].seq;
+
+  return (seq_a > seq_b) - (seq_a < seq_b);
+}
+
+GstPixelflutUring *
+gst_pixelflut_uring_new (guint n_arenas, gsize arena_size, GError **err)
+{
+  static gsize debug_initialized = 0;
+  GstPixelflutUring *uring;
+  struct io_uring_probe *probe;
+  struct iovec *iovecs;
+  guint i;
+  gint res;
+
+  if (g_once_init_enter (&debug_initialized)) {
+    GST_DEBUG_CATEGORY_INIT (pixelfluturing_debug, "pixelfluturing", 0,
+        "pixelflut io_uring sender");
+    g_once_init_leave (&debug_initialized, 1);
+  }
+
+  g_return_val_if_fail (n_arenas > 0, NULL);
+
+  uring = g_new0 (GstPixelflutUring, 1);
+
+  /* every arena is a send, each chain may need a poll in front */
+  res = io_uring_queue_init (2 * n_arenas, &uring->ring, 0);
+  if (res < 0) {
+    g_set_error (err, G_IO_ERROR, g_io_error_from_errno (-res),
+        "Could not set up io_uring: %s", g_strerror (-res));
+    g_free (uring);
+    return NULL;
+  }
+
+  probe = io_uring_get_probe_ring (&uring->ring);
+  uring->zerocopy = probe && io_uring_opcode_supported (probe, IORING_OP_SEND_ZC);
+  if (probe)
+    io_uring_free_probe (probe);
+
+  uring->n_arenas = n_arenas;
+  uring->arena_size = arena_size;
+  uring->memory = g_malloc (n_arenas * arena_size);
+  uring->arenas = g_new0 (GstPixelflutArena, n_arenas);
+  iovecs = g_new (struct iovec, n_arenas);
+  for (i = 0; i < n_arenas; i++) {
+    uring->arenas[i].data = uring->memory + i * arena_size;
+    uring->arenas[i].state = ARENA_FREE;
+    iovecs[i].iov_base = uring->arenas[i].data;
+    iovecs[i].iov_len = arena_size;
+  }
+
+  /* pinning the arenas once saves looking up the pages on every send */
+  res = io_uring_register_buffers (&uring->ring, iovecs, n_arenas);
+  uring->fixed = (res == 0);
+  if (!uring->fixed)
+    GST_INFO ("not using registered buffers: %s", g_strerror (-res));
+  g_free (iovecs);
+
+  g_queue_init (&uring->queued);
+  uring->seq = 0;
+  uring->sending = 0;
+  uring->need_poll = FALSE;
+  uring->error = NULL;
+
+  GST_DEBUG ("%u arenas of %" G_GSIZE_FORMAT " bytes, zerocopy %d, fixed %d",
+      n_arenas, arena_size, uring->zerocopy, uring->fixed);
+
+  return uring;
+}
+
+gboolean
+gst_pixelflut_uring_is_zerocopy (GstPixelflutUring *uring)
+{
+  return uring->zerocopy;
+}
+
+/* Submit everything queued as one linked chain, so the sends hit the
+ * socket in order even when one of them has to wait for buffer space. */
+static void
+gst_pixelflut_uring_submit_queued (GstPixelflutUring *uring)
+{
+  struct io_uring_sqe *sqe;
+  guint idx;
+  gint res;
+
+  if (uring->sending || g_queue_is_empty (&uring->queued))
+    return;
+
+  if (uring->need_poll) {
+    idx = GPOINTER_TO_UINT (g_queue_peek_head (&uring->queued));
+    sqe = io_uring_get_sqe (&uring->ring);
+    io_uring_prep_poll_add (sqe, uring->arenas[idx].fd, POLLOUT);
+    io_uring_sqe_set_data64 (sqe, POLL_USER_DATA);
+    io_uring_sqe_set_flags (sqe, IOSQE_IO_LINK);
+    uring->need_poll = FALSE;
+  }
+
+  while (!g_queue_is_empty (&uring->queued)) {
+    GstPixelflutArena *arena;
+    gint flags = MSG_WAITALL | MSG_NOSIGNAL;
+
+    idx = GPOINTER_TO_UINT (g_queue_pop_head (&uring->queued));
+    arena = &uring->arenas[idx];
+    sqe = io_uring_get_sqe (&uring->ring);
+
+    /* what is left after a short send */
+    if (uring->zerocopy && uring->fixed)
+      io_uring_prep_send_zc_fixed (sqe, arena->fd, arena->data + arena->sent,
+          arena->len - arena->sent, flags, 0, idx);
+    else if (uring->zerocopy)
+      io_uring_prep_send_zc (sqe, arena->fd, arena->data + arena->sent,
+          arena->len - arena->sent, flags, 0);
+    else
+      io_uring_prep_send (sqe, arena->fd, arena->data + arena->sent,
+          arena->len - arena->sent, flags);
+    io_uring_sqe_set_data64 (sqe, idx);
+    if (!g_queue_is_empty (&uring->queued))
+      io_uring_sqe_set_flags (sqe, IOSQE_IO_LINK);
+
+    arena->state = ARENA_SENDING;
+    uring->sending++;
+  }
+
+  res = io_uring_submit (&uring->ring);
+  GST_TRACE ("submitted %u sends: %d", uring->sending, res);
+  if (res < 0 && !uring->error) {
+    g_set_error (&uring->error, G_IO_ERROR, g_io_error_from_errno (-res),
+        "Could not submit to io_uring: %s", g_strerror (-res));
+  }
+}
+
+static void
+gst_pixelflut_uring_handle_cqe (GstPixelflutUring *uring, struct io_uring_cqe *cqe)
+{
+  GstPixelflutArena *arena;
+  guint64 user_data = io_uring_cqe_get_data64 (cqe);
+
+  if (user_data == POLL_USER_DATA)
+    return;
+
+  arena = &uring->arenas[user_data];
+
+  /* second completion of a zero-copy send, the pages are ours again */
+  if (cqe->flags & IORING_CQE_F_NOTIF) {
+    arena->notifs--;
+    if (arena->state == ARENA_NOTIF && arena->notifs == 0)
+      arena->state = ARENA_FREE;
+    return;
+  }
+
+  uring->sending--;
+  if (cqe->flags & IORING_CQE_F_MORE)
+    arena->notifs++;
+  arena->state = arena->notifs ? ARENA_NOTIF : ARENA_FREE;
+
+  if (cqe->res > 0)
+    arena->sent += cqe->res;
+
+  if (uring->error || arena->dropped) {
+    /* nothing more is sent */
+    arena->dropped = FALSE;
+  } else if (cqe->res == -EAGAIN || cqe->res == -ECANCELED ||
+      (cqe->res > 0 && arena->sent < arena->len)) {
+    /* socket buffer full, or behind such a send in the chain: retry
+     * what is left in the original order once the socket is writable,
+     * the socket being non-blocking the kernel may have taken a part */
+    GST_LOG ("send of arena %" G_GUINT64_FORMAT " returned %d, retrying %"
+        G_GSIZE_FORMAT " bytes", user_data, cqe->res, arena->len - arena->sent);
+    arena->state = ARENA_QUEUED;
+    g_queue_insert_sorted (&uring->queued, GUINT_TO_POINTER (user_data),
+        gst_pixelflut_uring_compare_seq, uring);
+    uring->need_poll = TRUE;
+  } else if (cqe->res < 0) {
+    g_set_error (&uring->error, G_IO_ERROR, g_io_error_from_errno (-cqe->res),
+        "Error sending data: %s", g_strerror (-cqe->res));
+  } else if (cqe->res == 0 && arena->sent < arena->len) {
+    g_set_error (&uring->error, G_IO_ERROR, G_IO_ERROR_BROKEN_PIPE,
+        "Connection closed with %" G_GSIZE_FORMAT " of %" G_GSIZE_FORMAT
+        " bytes sent", arena->sent, arena->len);
+  }
+
+  /* nothing queued gets sent after an error */
+  if (uring->error) {
+    while (!g_queue_is_empty (&uring->queued)) {
+      guint idx = GPOINTER_TO_UINT (g_queue_pop_head (&uring->queued));
+      uring->arenas[idx].state =
+          uring->arenas[idx].notifs ? ARENA_NOTIF : ARENA_FREE;
+    }
+  }
+
+  gst_pixelflut_uring_submit_queued (uring);
+}
+
+/* Handle all available completions, waiting up to @timeout (in
+ * microseconds) for the first one if @timeout isn't 0 */
+static void
+gst_pixelflut_uring_reap (GstPixelflutUring *uring, gint64 timeout)
+{
+  struct io_uring_cqe *cqe;
+  gint res;
+
+  if (timeout) {
+    struct __kernel_timespec ts;
+
+    ts.tv_sec = timeout / G_USEC_PER_SEC;
+    ts.tv_nsec = (timeout % G_USEC_PER_SEC) * 1000;
+    res = io_uring_wait_cqe_timeout (&uring->ring, &cqe, &ts);
+  } else {
+    res = io_uring_peek_cqe (&uring->ring, &cqe);
+  }
+
+  while (res == 0) {
+    gst_pixelflut_uring_handle_cqe (uring, cqe);
+    io_uring_cqe_seen (&uring->ring, cqe);
+    res = io_uring_peek_cqe (&uring->ring, &cqe);
+  }
+}
+
+static gboolean
+gst_pixelflut_uring_busy (GstPixelflutUring *uring)
+{
+  guint i;
+
+  for (i = 0; i < uring->n_arenas; i++) {
+    if (uring->arenas[i].state != ARENA_FREE &&
+        uring->arenas[i].state != ARENA_FILLING)
+      return TRUE;
+  }
+
+  return FALSE;
+}
+
+static gboolean
+gst_pixelflut_uring_check_error (GstPixelflutUring *uring,
+    GCancellable *cancellable, GError **err)
+{
+  if (uring->error) {
+    g_propagate_error (err, g_error_copy (uring->error));
+    return FALSE;
+  }
+
+  return !g_cancellable_set_error_if_cancelled (cancellable, err);
+}
+
+/* Returns an arena to assemble the next packet in, which has to be
+ * passed to gst_pixelflut_uring_send() before asking for another one */
+gchar *
+gst_pixelflut_uring_get_arena (GstPixelflutUring *uring,
+    GCancellable *cancellable, GError **err)
+{
+  gint64 timeout = 0;
+
+  while (gst_pixelflut_uring_check_error (uring, cancellable, err)) {
+    guint i;
+
+    gst_pixelflut_uring_reap (uring, timeout);
+
+    for (i = 0; i < uring->n_arenas; i++) {
+      if (uring->arenas[i].state == ARENA_FREE) {
+        uring->arenas[i].state = ARENA_FILLING;
+        return uring->arenas[i].data;
+      }
+    }
+    timeout = WAIT_INTERVAL;
+  }
+
+  return NULL;
+}
+
+/* Queues @len bytes of @arena to be sent on @fd after everything sent
+ * before. Errors of earlier sends are reported here, in which case
+ * @arena isn't queued. */
+gboolean
+gst_pixelflut_uring_send (GstPixelflutUring *uring, gint fd, gchar *arena,
+    gsize len, GError **err)
+{
+  guint idx = (arena - uring->memory) / uring->arena_size;
+
+  g_return_val_if_fail (idx < uring->n_arenas, FALSE);
+  g_return_val_if_fail (uring->arenas[idx].state == ARENA_FILLING, FALSE);
+  g_return_val_if_fail (len <= uring->arena_size, FALSE);
+
+  /* the arena stays with the caller to send it again elsewhere */
+  if (!gst_pixelflut_uring_check_error (uring, NULL, err))
+    return FALSE;
+
+  uring->arenas[idx].len = len;
+  uring->arenas[idx].sent = 0;
+  uring->arenas[idx].dropped = FALSE;
+  uring->arenas[idx].fd = fd;
+  uring->arenas[idx].seq = uring->seq++;
+  uring->arenas[idx].state = ARENA_QUEUED;
+  g_queue_push_tail (&uring->queued, GUINT_TO_POINTER (idx));
+
+  gst_pixelflut_uring_submit_queued (uring);
+  gst_pixelflut_uring_reap (uring, 0);
+
+  return TRUE;
+}
+
+/* Waits until everything queued was sent, for at most DRAIN_TIMEOUT */
+gboolean
+gst_pixelflut_uring_drain (GstPixelflutUring *uring, GCancellable *cancellable,
+    GError **err)
+{
+  gint64 end = g_get_monotonic_time () + DRAIN_TIMEOUT;
+
+  while (gst_pixelflut_uring_check_error (uring, cancellable, err)) {
+    if (!gst_pixelflut_uring_busy (uring))
+      return TRUE;
+    if (g_get_monotonic_time () >= end) {
+      g_set_error_literal (err, G_IO_ERROR, G_IO_ERROR_TIMED_OUT,
+          "Timed out sending what was queued");
+      return FALSE;
+    }
+    gst_pixelflut_uring_reap (uring, WAIT_INTERVAL);
+  }
+
+  return FALSE;
+}
+
+/* Cancels all sends and waits up to FREE_TIMEOUT for the kernel to give
+ * back the arenas, the error keeps the cancelled sends from being
+ * retried */
+static void
+gst_pixelflut_uring_cancel (GstPixelflutUring *uring)
+{
+  struct io_uring_sqe *sqe;
+  gint64 end;
+
+  if (!uring->error)
+    uring->error = g_error_new_literal (G_IO_ERROR, G_IO_ERROR_CLOSED, "Closed");
+  while (!g_queue_is_empty (&uring->queued)) {
+    guint idx = GPOINTER_TO_UINT (g_queue_pop_head (&uring->queued));
+    uring->arenas[idx].state =
+        uring->arenas[idx].notifs ? ARENA_NOTIF : ARENA_FREE;
+  }
+
+  if (uring->sending) {
+    sqe = io_uring_get_sqe (&uring->ring);
+    io_uring_prep_cancel (sqe, NULL, IORING_ASYNC_CANCEL_ANY);
+    io_uring_sqe_set_data64 (sqe, POLL_USER_DATA);
+    io_uring_submit (&uring->ring);
+  }
+
+  end = g_get_monotonic_time () + FREE_TIMEOUT;
+  while (gst_pixelflut_uring_busy (uring) && g_get_monotonic_time () < end)
+    gst_pixelflut_uring_reap (uring, WAIT_INTERVAL);
+}
+
+/* Forgets about a failed connection: cancels what is in flight, gives
+ * the kernel a moment to hand back the arenas and clears the error, so
+ * sending can resume on a new socket. Whatever was in flight is lost. */
+void
+gst_pixelflut_uring_reset (GstPixelflutUring *uring)
+{
+  guint i;
+
+  gst_pixelflut_uring_cancel (uring);
+
+  /* sends the kernel still holds on to complete later, for the old socket */
+  for (i = 0; i < uring->n_arenas; i++) {
+    if (uring->arenas[i].state == ARENA_SENDING) {
+      GST_WARNING ("arena %u still in flight after reset", i);
+      uring->arenas[i].dropped = TRUE;
+    }
+  }
+
+  g_clear_error (&uring->error);
+  uring->need_poll = FALSE;
+}
+
+void
+gst_pixelflut_uring_free (GstPixelflutUring *uring)
+{
+  if (!uring)
+    return;
+
+  /* the arenas can only be freed once the kernel let go of them */
+  gst_pixelflut_uring_cancel (uring);
+
+  if (uring->fixed)
+    io_uring_unregister_buffers (&uring->ring);
+  io_uring_queue_exit (&uring->ring);
+
+  g_clear_error (&uring->error);
+  g_free (uring->arenas);
+  g_free (uring->memory);
+  g_free (uring);
+}
@@ -0,0 +1,55 @@
+/*
+ * GStreamer Pixelflut
+ * Copyright 2018 Andreas Frisch <fraxinas@schaffenburg.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __GST_PIXELFLUT_URING_H__
+#define __GST_PIXELFLUT_URING_H__
+
+#include <gst/gst.h>
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+/**
+ * GstPixelflutUring:
+ *
+ * Sends packets to a socket with io_uring. The packets are assembled in
+ * a fixed set of arenas registered with the kernel, which are sent
+ * with zero-copy when the kernel supports it and handed out again once
+ * the kernel is done with them. Only available when built with liburing.
+ */
+typedef struct _GstPixelflutUring GstPixelflutUring;
+
+GstPixelflutUring *gst_pixelflut_uring_new (guint n_arenas, gsize arena_size,
+    GError **err);
+void gst_pixelflut_uring_free (GstPixelflutUring *uring);
+
+gchar *gst_pixelflut_uring_get_arena (GstPixelflutUring *uring,
+    GCancellable *cancellable, GError **err);
+gboolean gst_pixelflut_uring_send (GstPixelflutUring *uring, gint fd,
+    gchar *arena, gsize len, GError **err);
+gboolean gst_pixelflut_uring_drain (GstPixelflutUring *uring,
+    GCancellable *cancellable, GError **err);
+void gst_pixelflut_uring_reset (GstPixelflutUring *uring);
+
+gboolean gst_pixelflut_uring_is_zerocopy (GstPixelflutUring *uring);
+
+G_END_DECLS
+
+#endif /* __GST_PIXELFLUT_URING_H__ */
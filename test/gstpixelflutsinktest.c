@@ -18,9 +18,59 @@
  * Boston, MA 02110-1301, USA.
  */
 
+#include <stdlib.h>
+#include <string.h>
+
 #include <gst/gst.h>
 
+#include "gstpixelflutstandin.h"
+
+/* canvas of the stand-in server */
+#define STANDIN_WIDTH 1024
+#define STANDIN_HEIGHT 768
+/* how often arrived markers are collected */
+#define COLLECT_INTERVAL 100
+/* after this long a marker counts as lost, in us */
+#define MARKER_TIMEOUT G_USEC_PER_SEC
+/* how often the load generator checks whether the canvas size is known */
+#define LOAD_POLL_INTERVAL 100
+
+/* a marker the sink sent and the stand-in server has yet to see */
+typedef struct
+{
+  guint counter;
+  gint64 due;
+  gint64 sent;
+} GstPixelflutSinkTestMarker;
+
 typedef struct _GstPixelflutSinkTest GstPixelflutSinkTest;
+
+/* counters of a sink at one point in time */
+typedef struct
+{
+  gint64 time;
+  guint64 frames;
+  guint64 pixels;
+  guint64 bytes;
+  guint64 reconnects;
+} GstPixelflutSinkTestCounters;
+
+/* one of the parallel sinks of the load generator */
+typedef struct
+{
+  GstPixelflutSinkTest *test;
+  guint index;
+  GstElement *pipeline;
+  GstElement *source;
+  GstElement *pixelflutsink;
+  const gchar *pattern;
+  gchar *strategy;
+  gint left, top;
+  gboolean failed;
+  GstPixelflutSinkTestCounters start;
+  GstPixelflutSinkTestCounters end;
+} GstPixelflutSinkTestClient;
+
 struct _GstPixelflutSinkTest
 {
   gint offset_top, offset_left;
@@ -33,6 +83,17 @@ struct _GstPixelflutSinkTest
   GstElement *pixelflutsink;
   GstBus *bus;
   GMainLoop *main_loop;
+
+  /* latency measurement, in us */
+  GstPixelflutStandin *standin;
+  GQueue pending;
+  GArray *render;
+  GArray *transport;
+  GArray *total;
+  guint lost;
+
+  /* load generator */
+  GPtrArray *clients;
 };
 
 GstPixelflutSinkTest *gst_pixelflutsink_test_new (void);
@@ -45,6 +106,18 @@ static guint port = 1337;
 static guint interval = 10;
 static guint width = 320;
 static guint height = 240;
+static guint latency_frames = 0;
+static gchar **sink_settings = NULL;
+static gboolean use_standin = FALSE;
+static guint load_clients = 0;
+static guint load_duration = 10;
+static const gchar *load_strategies = NULL;
+
+/* sources of the load generator's clients, in turn */
+static const gchar *load_patterns[] = {
+  "smpte", "ball", "snow", "circular", "zone-plate", "pinwheel", "spokes",
+  "gamut", "chroma-zone-plate", "colors", "checkers-8", "gradient"
+};
 
 static GOptionEntry entries[] = {
   {"uri", 'u', 0, G_OPTION_ARG_STRING, &source_uri, "Source URI", NULL},
@@ -53,6 +126,12 @@ static GOptionEntry entries[] = {
   {"interval", 'i', 0, G_OPTION_ARG_INT, &interval, "Interval between offset moves in ms", NULL},
   {"width", 'x', 0, G_OPTION_ARG_INT, &width, "Painting width of input in px", NULL},
   {"height", 'y', 0, G_OPTION_ARG_INT, &height, "Paiting height of input in px", NULL},
+  {"latency", 'l', 0, G_OPTION_ARG_INT, &latency_frames, "Measure the latency of this many frames against a built-in stand-in server on the port", NULL},
+  {"set", 's', 0, G_OPTION_ARG_STRING_ARRAY, &sink_settings, "Set a property of the sink, can be repeated", "PROPERTY=VALUE"},
+  {"standin", 'S', 0, G_OPTION_ARG_NONE, &use_standin, "Send to a built-in stand-in server on the port", NULL},
+  {"clients", 'c', 0, G_OPTION_ARG_INT, &load_clients, "Generate load with this many sinks in parallel and report their throughput", NULL},
+  {"duration", 'd', 0, G_OPTION_ARG_INT, &load_duration, "How long to measure the load in s", NULL},
+  {"strategies", 0, 0, G_OPTION_ARG_STRING, &load_strategies, "Strategies the clients take in turn", "full,update"},
   {NULL, 0, 0, 0, NULL, NULL, NULL}
 };
 
@@ -61,6 +140,10 @@ GstPixelflutSinkTest *gst_pixelflutsink_test_new (void)
   GstPixelflutSinkTest *test;
 
   test = g_new0 (GstPixelflutSinkTest, 1);
+  g_queue_init (&test->pending);
+  test->render = g_array_new (FALSE, FALSE, sizeof (gint64));
+  test->transport = g_array_new (FALSE, FALSE, sizeof (gint64));
+  test->total = g_array_new (FALSE, FALSE, sizeof (gint64));
 
   return test;
 }
@@ -119,6 +202,17 @@ gboolean move_offset (GstPixelflutSinkTest *t)
   static gint x_direction;
   static gint y_direction;
 
+  /* the sink connects in the background, the canvas size is known
+   * once the first frame was sent */
+  if (!t->canvas_width || !t->canvas_height) {
+    g_object_get (t->pixelflutsink, "canvas-width", &t->canvas_width,
+                                    "canvas-height", &t->canvas_height,
+                                    NULL);
+    if (!t->canvas_width || !t->canvas_height)
+      return TRUE;
+    g_print ("canvas size = (%dx%d)\n", t->canvas_width, t->canvas_height);
+  }
+
   if (t->offset_left + width >= t->canvas_width) {
     x_direction = -1;
   } else if (t->offset_left <= 0) {
@@ -143,6 +237,83 @@ gboolean move_offset (GstPixelflutSinkTest *t)
   return TRUE;
 }
 
+static gint
+compare_latency (gconstpointer a, gconstpointer b)
+{
+  gint64 la = *(const gint64 *) a, lb = *(const gint64 *) b;
+
+  return la < lb ? -1 : la > lb;
+}
+
+static void
+print_percentiles (const gchar *name, GArray *latencies)
+{
+  static const guint percentiles[] = { 50, 90, 99, 100 };
+  guint i;
+
+  g_array_sort (latencies, compare_latency);
+
+  g_print ("  %-18s", name);
+  for (i = 0; i < G_N_ELEMENTS (percentiles); i++) {
+    guint idx = (latencies->len - 1) * percentiles[i] / 100;
+
+    g_print (" p%-3u %8.2f ms", percentiles[i],
+        g_array_index (latencies, gint64, idx) / 1000.0);
+  }
+  g_print ("\n");
+}
+
+static void
+print_latency_report (GstPixelflutSinkTest *t)
+{
+  gchar *settings = sink_settings ? g_strjoinv (" ", sink_settings) : g_strdup ("defaults");
+
+  g_print ("\nlatency of %u frames (%u lost) with %s:\n", t->total->len, t->lost,
+      settings);
+  if (t->total->len) {
+    print_percentiles ("due to sent", t->render);
+    print_percentiles ("sent to canvas", t->transport);
+    print_percentiles ("due to canvas", t->total);
+  }
+  g_free (settings);
+}
+
+/* Match the markers the sink sent with their arrival at the server */
+gboolean collect_markers (GstPixelflutSinkTest *t)
+{
+  gint64 now = g_get_monotonic_time ();
+  GList *l, *next;
+
+  for (l = t->pending.head; l; l = next) {
+    GstPixelflutSinkTestMarker *marker = l->data;
+    gint64 arrival, latency;
+
+    next = l->next;
+    if (gst_pixelflut_standin_pop_arrival (t->standin, marker->counter, &arrival)) {
+      latency = marker->sent - marker->due;
+      g_array_append_val (t->render, latency);
+      latency = arrival - marker->sent;
+      g_array_append_val (t->transport, latency);
+      latency = arrival - marker->due;
+      g_array_append_val (t->total, latency);
+    } else if (now - marker->sent > MARKER_TIMEOUT) {
+      t->lost++;
+    } else {
+      continue;
+    }
+    g_queue_delete_link (&t->pending, l);
+    g_free (marker);
+  }
+
+  if (t->total->len + t->lost >= latency_frames) {
+    print_latency_report (t);
+    g_main_loop_quit (t->main_loop);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
 static gboolean
 handle_message (GstBus * bus, GstMessage * message, gpointer data)
 {
@@ -168,22 +339,19 @@ handle_message (GstBus * bus, GstMessage * message, gpointer data)
       g_main_loop_quit (t->main_loop);
       return FALSE;
     }
-    case GST_MESSAGE_STATE_CHANGED:
+    case GST_MESSAGE_ELEMENT:
     {
-      GstState oldstate, newstate, pending;
-      gst_message_parse_state_changed (message, &oldstate, &newstate, &pending);
-      if (GST_ELEMENT (message->src) == t->pipeline) {
-        switch (GST_STATE_TRANSITION (oldstate, newstate)) {
-          case GST_STATE_CHANGE_NULL_TO_READY:
-            g_object_get (t->pixelflutsink, "canvas-width", &t->canvas_width,
-                                            "canvas-height", &t->canvas_height,
-                                            NULL);
-            g_print ("canvas size = (%dx%d)\n", t->canvas_width, t->canvas_height);
-            break;
-          default:
-            break;
-        }
-      }
+      const GstStructure *s = gst_message_get_structure (message);
+      GstPixelflutSinkTestMarker *marker;
+
+      if (!latency_frames || !gst_message_has_name (message, "pixelflut-latency-marker"))
+        break;
+
+      marker = g_new0 (GstPixelflutSinkTestMarker, 1);
+      gst_structure_get (s, "counter", G_TYPE_UINT, &marker->counter,
+          "due-time", G_TYPE_INT64, &marker->due,
+          "sent-time", G_TYPE_INT64, &marker->sent, NULL);
+      g_queue_push_tail (&t->pending, marker);
       break;
     }
     default:
@@ -192,6 +360,290 @@ handle_message (GstBus * bus, GstMessage * message, gpointer data)
   return TRUE;
 }
 
+/* Applies the --set options to @sink */
+static gboolean
+apply_sink_settings (GstElement *sink)
+{
+  gchar **setting;
+
+  for (setting = sink_settings; setting && *setting; setting++) {
+    gchar **kv = g_strsplit (*setting, "=", 2);
+
+    if (!kv[0] || !kv[1]) {
+      g_printerr ("Invalid sink setting '%s', expected PROPERTY=VALUE\n", *setting);
+      g_strfreev (kv);
+      return FALSE;
+    }
+    gst_util_set_object_arg (G_OBJECT (sink), kv[0], kv[1]);
+    g_strfreev (kv);
+  }
+
+  return TRUE;
+}
+
+/* The value of property @name of @sink as a string */
+static gchar *
+get_sink_property (GstElement *sink, const gchar *name)
+{
+  GParamSpec *pspec = g_object_class_find_property (G_OBJECT_GET_CLASS (sink), name);
+  GValue value = G_VALUE_INIT;
+  gchar *str;
+
+  g_value_init (&value, pspec->value_type);
+  g_object_get_property (G_OBJECT (sink), name, &value);
+  str = gst_value_serialize (&value);
+  g_value_unset (&value);
+
+  return str;
+}
+
+static void
+read_counters (GstPixelflutSinkTestClient *c, GstPixelflutSinkTestCounters *counters)
+{
+  counters->time = g_get_monotonic_time ();
+  g_object_get (c->pixelflutsink, "frames-sent", &counters->frames,
+                                  "pixels-sent", &counters->pixels,
+                                  "bytes-written", &counters->bytes,
+                                  "reconnects", &counters->reconnects,
+                                  NULL);
+}
+
+static gboolean
+handle_client_message (GstBus * bus, GstMessage * message, gpointer data)
+{
+  GstPixelflutSinkTestClient *c = data;
+
+  switch (GST_MESSAGE_TYPE (message)) {
+    case GST_MESSAGE_WARNING:
+    {
+      GError *error = NULL;
+      gchar *debug;
+
+      gst_message_parse_warning (message, &error, &debug);
+      g_print ("WARNING from client %u: %s\n", c->index, error->message);
+      g_clear_error (&error);
+      g_free (debug);
+      break;
+    }
+    case GST_MESSAGE_ERROR:
+    {
+      GError *error = NULL;
+      gchar *debug;
+      guint i, failed = 0;
+
+      gst_message_parse_error (message, &error, &debug);
+      g_print ("ERROR from client %u: %s\n", c->index, error->message);
+      g_clear_error (&error);
+      g_free (debug);
+
+      /* the others keep going, unless none is left */
+      c->failed = TRUE;
+      for (i = 0; i < c->test->clients->len; i++) {
+        GstPixelflutSinkTestClient *other = g_ptr_array_index (c->test->clients, i);
+        failed += other->failed;
+      }
+      if (failed == c->test->clients->len)
+        g_main_loop_quit (c->test->main_loop);
+      return FALSE;
+    }
+    default:
+      break;
+  }
+  return TRUE;
+}
+
+static GstPixelflutSinkTestClient *
+create_client (GstPixelflutSinkTest *t, guint index, gchar **strategies)
+{
+  GstPixelflutSinkTestClient *c;
+  GstElement *videoconvert, *videoscale, *capsfilter;
+  gchar *caps, *name;
+  GstBus *bus;
+  gboolean ret;
+
+  c = g_new0 (GstPixelflutSinkTestClient, 1);
+  c->test = t;
+  c->index = index;
+  c->pattern = load_patterns[index % G_N_ELEMENTS (load_patterns)];
+
+  name = g_strdup_printf ("client%u", index);
+  c->pipeline = gst_pipeline_new (name);
+  g_free (name);
+
+  c->source = gst_element_factory_make ("videotestsrc", NULL);
+  videoconvert = gst_element_factory_make ("videoconvert", NULL);
+  videoscale = gst_element_factory_make ("videoscale", NULL);
+  capsfilter = gst_element_factory_make ("capsfilter", NULL);
+  c->pixelflutsink = gst_element_factory_make ("pixelflutsink", NULL);
+  g_assert (c->source && videoconvert && videoscale && capsfilter && c->pixelflutsink);
+
+  g_object_set (G_OBJECT (c->source), "is-live", TRUE, NULL);
+  gst_util_set_object_arg (G_OBJECT (c->source), "pattern", c->pattern);
+  caps = g_strdup_printf ("video/x-raw, width=%d, height=%d", width, height);
+  gst_util_set_object_arg (G_OBJECT (capsfilter), "caps", caps);
+  g_free (caps);
+
+  g_object_set (G_OBJECT (c->pixelflutsink), "host", host, "port", port, NULL);
+  if (!apply_sink_settings (c->pixelflutsink))
+    return NULL;
+  if (strategies && strategies[0]) {
+    gst_util_set_object_arg (G_OBJECT (c->pixelflutsink), "strategy",
+        strategies[index % g_strv_length (strategies)]);
+  }
+  c->strategy = get_sink_property (c->pixelflutsink, "strategy");
+
+  gst_bin_add_many (GST_BIN (c->pipeline), c->source, videoconvert, videoscale,
+      capsfilter, c->pixelflutsink, NULL);
+  ret = gst_element_link_many (c->source, videoconvert, videoscale, capsfilter,
+      c->pixelflutsink, NULL);
+  g_assert (ret);
+
+  bus = gst_pipeline_get_bus (GST_PIPELINE (c->pipeline));
+  gst_bus_add_watch (bus, handle_client_message, c);
+  gst_object_unref (bus);
+
+  return c;
+}
+
+static void
+print_client_line (const gchar *name, const gchar *region, const gchar *pattern,
+    const gchar *strategy, guint64 frames, gdouble pixels, gdouble bytes, guint64 reconnects)
+{
+  g_print ("%-8s %-21s %-17s %-8s %8" G_GUINT64_FORMAT " %14.0f %14.0f %10"
+      G_GUINT64_FORMAT "\n",
+      name, region, pattern, strategy, frames, pixels, bytes, reconnects);
+}
+
+static void
+print_load_report (GstPixelflutSinkTest *t)
+{
+  guint64 frames = 0;
+  gdouble pixels = 0, bytes = 0;
+  guint64 reconnects = 0;
+  guint i;
+
+  g_print ("\n%-8s %-21s %-17s %-8s %8s %14s %14s %10s\n", "client", "region",
+      "source", "strategy", "frames", "pixels/s", "bytes/s", "reconnects");
+
+  for (i = 0; i < t->clients->len; i++) {
+    GstPixelflutSinkTestClient *c = g_ptr_array_index (t->clients, i);
+    gdouble seconds = (c->end.time - c->start.time) / (gdouble) G_USEC_PER_SEC;
+    gdouble client_pixels = (c->end.pixels - c->start.pixels) / seconds;
+    gdouble client_bytes = (c->end.bytes - c->start.bytes) / seconds;
+    gchar *name = g_strdup_printf ("%u%s", c->index, c->failed ? " failed" : "");
+    gchar *region = g_strdup_printf ("%dx%d+%d+%d", width, height, c->left, c->top);
+
+    print_client_line (name, region, c->pattern, c->strategy,
+        c->end.frames - c->start.frames, client_pixels, client_bytes,
+        c->end.reconnects - c->start.reconnects);
+    frames += c->end.frames - c->start.frames;
+    pixels += client_pixels;
+    bytes += client_bytes;
+    reconnects += c->end.reconnects - c->start.reconnects;
+    g_free (name);
+    g_free (region);
+  }
+
+  print_client_line ("total", "", "", "", frames, pixels, bytes, reconnects);
+}
+
+gboolean finish_load (GstPixelflutSinkTest *t)
+{
+  guint i;
+
+  for (i = 0; i < t->clients->len; i++) {
+    GstPixelflutSinkTestClient *c = g_ptr_array_index (t->clients, i);
+    read_counters (c, &c->end);
+  }
+
+  print_load_report (t);
+  g_main_loop_quit (t->main_loop);
+
+  return FALSE;
+}
+
+/* Spreads the clients over the canvas once its size is known and starts
+ * measuring, so that connecting doesn't count */
+gboolean start_load (GstPixelflutSinkTest *t)
+{
+  guint columns, rows, i;
+
+  /* any client that hasn't failed can tell */
+  for (i = 0; i < t->clients->len; i++) {
+    GstPixelflutSinkTestClient *c = g_ptr_array_index (t->clients, i);
+
+    if (c->failed)
+      continue;
+    g_object_get (c->pixelflutsink, "canvas-width", &t->canvas_width,
+                                    "canvas-height", &t->canvas_height,
+                                    NULL);
+    if (t->canvas_width && t->canvas_height)
+      break;
+  }
+  if (!t->canvas_width || !t->canvas_height)
+    return TRUE;
+
+  /* side by side as far as they fit, overlapping beyond that */
+  columns = MAX (1, t->canvas_width / width);
+  rows = MAX (1, t->canvas_height / height);
+  g_print ("canvas size = (%dx%d), measuring %u clients for %u s\n",
+      t->canvas_width, t->canvas_height, t->clients->len, load_duration);
+
+  for (i = 0; i < t->clients->len; i++) {
+    GstPixelflutSinkTestClient *c = g_ptr_array_index (t->clients, i);
+
+    c->left = (i % columns) * width;
+    c->top = (i / columns % rows) * height;
+    g_object_set (G_OBJECT (c->pixelflutsink), "offset-left", c->left,
+        "offset-top", c->top, NULL);
+    read_counters (c, &c->start);
+  }
+
+  g_timeout_add_seconds (load_duration, (GSourceFunc) finish_load, t);
+
+  return FALSE;
+}
+
+static int
+run_load (GstPixelflutSinkTest *t)
+{
+  gchar **strategies = load_strategies ? g_strsplit (load_strategies, ",", -1) : NULL;
+  guint i;
+
+  t->clients = g_ptr_array_new ();
+  for (i = 0; i < load_clients; i++) {
+    GstPixelflutSinkTestClient *c = create_client (t, i, strategies);
+
+    if (!c)
+      return 1;
+    g_ptr_array_add (t->clients, c);
+  }
+  g_strfreev (strategies);
+
+  g_print ("starting %u clients sending to %s:%u\n", load_clients, host, port);
+  for (i = 0; i < t->clients->len; i++) {
+    GstPixelflutSinkTestClient *c = g_ptr_array_index (t->clients, i);
+    gst_element_set_state (c->pipeline, GST_STATE_PLAYING);
+  }
+
+  g_timeout_add (LOAD_POLL_INTERVAL, (GSourceFunc) start_load, t);
+
+  g_main_loop_run (t->main_loop);
+
+  for (i = 0; i < t->clients->len; i++) {
+    GstPixelflutSinkTestClient *c = g_ptr_array_index (t->clients, i);
+
+    gst_element_set_state (c->pipeline, GST_STATE_NULL);
+    gst_object_unref (c->pipeline);
+    g_free (c->strategy);
+    g_free (c);
+  }
+  g_ptr_array_free (t->clients, TRUE);
+  gst_pixelflut_standin_free (t->standin);
+
+  return 0;
+}
+
 int main(int argc, char *argv[]) {
   GstPixelflutSinkTest *t;
   GOptionContext *context;
@@ -212,6 +664,21 @@ int main(int argc, char *argv[]) {
 
   t->main_loop = g_main_loop_new (NULL, TRUE);
 
+  if (latency_frames || use_standin) {
+    /* markers are timestamped on the same clock as the sink's messages */
+    t->standin = gst_pixelflut_standin_new (port, STANDIN_WIDTH, STANDIN_HEIGHT,
+        0, 0, &error);
+    if (!t->standin) {
+      g_printerr ("Error starting stand-in server: %s\n", error->message);
+      return 1;
+    }
+    host = "127.0.0.1";
+    g_print ("stand-in server listening on port %u\n", port);
+  }
+
+  if (load_clients)
+    return run_load (t);
+
   t->pipeline = gst_pipeline_new ("pixelflutsinktest");
 
   if (source_uri) {
@@ -244,6 +711,11 @@ int main(int argc, char *argv[]) {
   g_assert (t->pixelflutsink);
   g_object_set (G_OBJECT (t->pixelflutsink), "host", host, NULL);
   g_object_set (G_OBJECT (t->pixelflutsink), "port", port, NULL);
+  if (latency_frames)
+    g_object_set (G_OBJECT (t->pixelflutsink), "latency-marker", TRUE, NULL);
+
+  if (!apply_sink_settings (t->pixelflutsink))
+    return 1;
 
   gst_bin_add_many (GST_BIN (t->pipeline), t->source, t->videoconvert, t->videoscale, t->capsfilter, t->pixelflutsink, NULL);
 
@@ -265,10 +737,13 @@ int main(int argc, char *argv[]) {
 
   g_print ("adding move callback with timeout=%d ms\n", interval);
   g_timeout_add (interval, (GSourceFunc) move_offset, t);
+  if (latency_frames)
+    g_timeout_add (COLLECT_INTERVAL, (GSourceFunc) collect_markers, t);
 
   g_main_loop_run (t->main_loop);
 
   gst_element_set_state (t->pipeline, GST_STATE_NULL);
   gst_object_unref (t->pipeline);
+  gst_pixelflut_standin_free (t->standin);
   return 0;
 }
@@ -0,0 +1,258 @@
+/*
+ * GStreamer Pixelflut
+ * Copyright 2018 Andreas Frisch <fraxinas@schaffenburg.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <string.h>
+
+#include "gstpixelflutstandin.h"
+
+#define STANDIN_BUFFER_SIZE 65536
+
+struct _GstPixelflutStandin
+{
+  GSocketService *service;
+  guint width;
+  guint height;
+  guint marker_x;
+  guint marker_y;
+
+  /* counter -> first arrival and the connections being served,
+   * protected by lock */
+  GMutex lock;
+  GCond cond;
+  GHashTable *arrivals;
+  guint active;
+};
+
+static void
+gst_pixelflut_standin_marker (GstPixelflutStandin *standin, guint32 counter,
+    gint64 now)
+{
+  gint64 *arrival;
+
+  g_mutex_lock (&standin->lock);
+  if (!g_hash_table_contains (standin->arrivals, GUINT_TO_POINTER (counter))) {
+    arrival = g_new (gint64, 1);
+    *arrival = now;
+    g_hash_table_insert (standin->arrivals, GUINT_TO_POINTER (counter), arrival);
+  }
+  g_mutex_unlock (&standin->lock);
+}
+
+/* Takes the next word of [*p, end) into [*word, *p), FALSE at the end */
+static gboolean
+gst_pixelflut_standin_word (const gchar **p, const gchar *end,
+    const gchar **word)
+{
+  while (*p < end && (**p == ' ' || **p == '\r'))
+    (*p)++;
+  *word = *p;
+  while (*p < end && **p != ' ' && **p != '\r')
+    (*p)++;
+
+  return *p > *word;
+}
+
+/* Parses a number in @base from [word, end), FALSE unless all of it is one */
+static gboolean
+gst_pixelflut_standin_number (const gchar *word, const gchar *end, guint base,
+    guint32 *value)
+{
+  guint digit;
+
+  *value = 0;
+  for (; word < end; word++) {
+    if (*word >= '0' && *word <= '9')
+      digit = *word - '0';
+    else if (base == 16 && *word >= 'a' && *word <= 'f')
+      digit = *word - 'a' + 10;
+    else if (base == 16 && *word >= 'A' && *word <= 'F')
+      digit = *word - 'A' + 10;
+    else
+      return FALSE;
+    *value = *value * base + digit;
+  }
+
+  return TRUE;
+}
+
+/* Handles the command in [line, end), parsed in place so that the
+ * stand-in keeps up with the clients */
+static void
+gst_pixelflut_standin_command (GstPixelflutStandin *standin,
+    GOutputStream *out, const gchar *line, const gchar *end)
+{
+  const gchar *word, *p = line;
+  gchar reply[64];
+  guint32 x, y, color;
+  gint len;
+
+  if (!gst_pixelflut_standin_word (&p, end, &word))
+    return;
+
+  if (p - word == 4 && !memcmp (word, "SIZE", 4)) {
+    len = g_snprintf (reply, sizeof (reply), "SIZE %u %u\n", standin->width,
+        standin->height);
+    g_output_stream_write_all (out, reply, len, NULL, NULL, NULL);
+    return;
+  }
+
+  if (p - word != 2 || memcmp (word, "PX", 2))
+    return;
+  if (!gst_pixelflut_standin_word (&p, end, &word) ||
+      !gst_pixelflut_standin_number (word, p, 10, &x))
+    return;
+  if (!gst_pixelflut_standin_word (&p, end, &word) ||
+      !gst_pixelflut_standin_number (word, p, 10, &y))
+    return;
+
+  if (!gst_pixelflut_standin_word (&p, end, &word)) {
+    len = g_snprintf (reply, sizeof (reply), "PX %u %u 000000\n", x, y);
+    g_output_stream_write_all (out, reply, len, NULL, NULL, NULL);
+    return;
+  }
+
+  if (x != standin->marker_x || y != standin->marker_y)
+    return;
+  if ((p - word != 6 && p - word != 8) ||
+      !gst_pixelflut_standin_number (word, p, 16, &color))
+    return;
+
+  /* with alpha */
+  if (p - word == 8)
+    color >>= 8;
+  gst_pixelflut_standin_marker (standin, color, g_get_monotonic_time ());
+}
+
+static gboolean
+gst_pixelflut_standin_run (GThreadedSocketService *service,
+    GSocketConnection *connection, GObject *source_object, gpointer data)
+{
+  GstPixelflutStandin *standin = data;
+  GInputStream *in = g_io_stream_get_input_stream (G_IO_STREAM (connection));
+  GOutputStream *out = g_io_stream_get_output_stream (G_IO_STREAM (connection));
+  gchar *buffer, *line, *newline;
+  gsize fill = 0;
+  gssize len;
+
+  g_mutex_lock (&standin->lock);
+  standin->active++;
+  g_mutex_unlock (&standin->lock);
+
+  buffer = g_malloc (STANDIN_BUFFER_SIZE);
+
+  while ((len = g_input_stream_read (in, buffer + fill,
+              STANDIN_BUFFER_SIZE - fill, NULL, NULL)) > 0) {
+    fill += len;
+    line = buffer;
+    while ((newline = memchr (line, '\n', buffer + fill - line))) {
+      gst_pixelflut_standin_command (standin, out, line, newline);
+      line = newline + 1;
+    }
+
+    /* keep the partial line for the next read, drop overlong ones */
+    fill -= line - buffer;
+    if (fill == STANDIN_BUFFER_SIZE)
+      fill = 0;
+    else if (fill && line != buffer)
+      memmove (buffer, line, fill);
+  }
+
+  g_free (buffer);
+
+  g_mutex_lock (&standin->lock);
+  standin->active--;
+  g_cond_signal (&standin->cond);
+  g_mutex_unlock (&standin->lock);
+
+  return TRUE;
+}
+
+GstPixelflutStandin *
+gst_pixelflut_standin_new (guint port, guint width, guint height,
+    guint marker_x, guint marker_y, GError **err)
+{
+  GstPixelflutStandin *standin;
+
+  standin = g_new0 (GstPixelflutStandin, 1);
+  standin->width = width;
+  standin->height = height;
+  standin->marker_x = marker_x;
+  standin->marker_y = marker_y;
+  g_mutex_init (&standin->lock);
+  g_cond_init (&standin->cond);
+  standin->arrivals = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+      NULL, g_free);
+
+  /* each connection takes a thread, so don't limit them below what the
+   * clients and their standby connections open */
+  standin->service = g_threaded_socket_service_new (-1);
+  if (!g_socket_listener_add_inet_port (G_SOCKET_LISTENER (standin->service),
+          port, NULL, err)) {
+    gst_pixelflut_standin_free (standin);
+    return NULL;
+  }
+  g_signal_connect (standin->service, "run",
+      G_CALLBACK (gst_pixelflut_standin_run), standin);
+  g_socket_service_start (standin->service);
+
+  return standin;
+}
+
+/* Takes the arrival time of the marker with @counter, if it arrived */
+gboolean
+gst_pixelflut_standin_pop_arrival (GstPixelflutStandin *standin,
+    guint32 counter, gint64 *arrival)
+{
+  gint64 *time;
+  gboolean found = FALSE;
+
+  g_mutex_lock (&standin->lock);
+  time = g_hash_table_lookup (standin->arrivals, GUINT_TO_POINTER (counter));
+  if (time) {
+    *arrival = *time;
+    g_hash_table_remove (standin->arrivals, GUINT_TO_POINTER (counter));
+    found = TRUE;
+  }
+  g_mutex_unlock (&standin->lock);
+
+  return found;
+}
+
+void
+gst_pixelflut_standin_free (GstPixelflutStandin *standin)
+{
+  if (!standin)
+    return;
+
+  g_socket_service_stop (standin->service);
+  g_socket_listener_close (G_SOCKET_LISTENER (standin->service));
+
+  /* the clients have to hang up first */
+  g_mutex_lock (&standin->lock);
+  while (standin->active)
+    g_cond_wait (&standin->cond, &standin->lock);
+  g_mutex_unlock (&standin->lock);
+
+  g_object_unref (standin->service);
+  g_hash_table_unref (standin->arrivals);
+  g_cond_clear (&standin->cond);
+  g_mutex_clear (&standin->lock);
+  g_free (standin);
+}
@@ -0,0 +1,45 @@
+/*
+ * GStreamer Pixelflut
+ * Copyright 2018 Andreas Frisch <fraxinas@schaffenburg.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __GST_PIXELFLUT_STANDIN_H__
+#define __GST_PIXELFLUT_STANDIN_H__
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+/**
+ * GstPixelflutStandin:
+ *
+ * A minimal Pixelflut server standing in for a real one. It answers SIZE
+ * and timestamps the arrival of the latency markers of pixelflutsink, in
+ * g_get_monotonic_time() microseconds.
+ */
+typedef struct _GstPixelflutStandin GstPixelflutStandin;
+
+GstPixelflutStandin *gst_pixelflut_standin_new (guint port, guint width,
+    guint height, guint marker_x, guint marker_y, GError **err);
+gboolean gst_pixelflut_standin_pop_arrival (GstPixelflutStandin *standin,
+    guint32 counter, gint64 *arrival);
+void gst_pixelflut_standin_free (GstPixelflutStandin *standin);
+
+G_END_DECLS
+
+#endif /* __GST_PIXELFLUT_STANDIN_H__ */